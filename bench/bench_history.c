@@ -0,0 +1,688 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/*
+ * Throughput benchmarks of the history engine.
+ *
+ * Every measurement is printed as one JSON object per line, so the output of
+ * two releases can be compared with any JSON-aware tool:
+ *
+ *   {"case":"schedule","layout":"dense","phases":1,"events":1000,...}
+ *
+ * Usage: bench_history [--max-events N] [--max-threads N] [--filter CASE]
+ */
+#include <rewind/rewind.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+struct bench_event {
+  int amount;
+};
+
+struct bench_state {
+  long value;
+};
+
+static void bench_event_apply(const struct bench_event* e,
+                              struct bench_state* s) {
+  __atomic_add_fetch(&s->value, e->amount, __ATOMIC_RELAXED);
+}
+
+static void bench_event_batch_apply(const struct bench_event* e,
+                                    int count,
+                                    struct bench_state* s) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < count; ++i)
+    sum += e[i].amount;
+  __atomic_add_fetch(&s->value, sum, __ATOMIC_RELAXED);
+}
+
+static void bench_event_columns_apply(const void* const* columns,
+                                      int count,
+                                      struct bench_state* s) {
+  const int* amounts = columns[0];
+  long sum = 0;
+  int i;
+  for (i = 0; i < count; ++i)
+    sum += amounts[i];
+  __atomic_add_fetch(&s->value, sum, __ATOMIC_RELAXED);
+}
+
+/*
+ * Allocator counting the calls made by the history
+ */
+struct bench_allocator_stats {
+  long allocs;
+};
+
+static void* bench_alloc(size_t size, struct bench_allocator_stats* stats) {
+  stats->allocs += 1;
+  return malloc(size);
+}
+
+static void* bench_realloc(void* ptr,
+                           size_t old_size,
+                           size_t new_size,
+                           struct bench_allocator_stats* stats) {
+  (void)old_size;
+  stats->allocs += 1;
+  return realloc(ptr, new_size);
+}
+
+static void bench_free(void* ptr,
+                       size_t size,
+                       struct bench_allocator_stats* stats) {
+  (void)size;
+  (void)stats;
+  free(ptr);
+}
+
+/*
+ * Shape of the timeline
+ */
+struct bench_layout {
+  const char* name;
+  int events_per_timepoint;
+  int timepoint_stride; /* distance between populated timepoints */
+};
+
+static const struct bench_layout bench_layouts[] = {
+    {"dense", 16, 1},
+    {"sparse", 16, 997},
+    {"hot", -10, 1}, /* negative: that many timepoints in total */
+};
+
+struct bench_config {
+  const struct bench_layout* layout;
+  int phases;
+  int events;
+};
+
+struct bench_fixture {
+  struct bench_config config;
+  struct bench_event* events;
+  RwnEventSpec* specs;
+  RwnEventHandle** handles;
+  int last_timepoint;
+  struct bench_allocator_stats alloc_stats;
+  RwnAllocator allocator;
+};
+
+static const char* bench_filter = NULL;
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static int case_enabled(const char* name) {
+  return bench_filter == NULL || strcmp(bench_filter, name) == 0;
+}
+
+static void report(const struct bench_fixture* f,
+                   const char* name,
+                   int threads,
+                   double elapsed_ns,
+                   long allocs) {
+  printf(
+      "{\"case\":\"%s\",\"layout\":\"%s\",\"phases\":%d,\"events\":%d,"
+      "\"threads\":%d,\"ns_per_event\":%.2f,\"allocs\":%ld,"
+      "\"peak_rss_kb\":%ld}\n",
+      name, f->config.layout->name, f->config.phases, f->config.events,
+      threads, elapsed_ns / f->config.events, allocs, peak_rss_kb());
+  fflush(stdout);
+}
+
+static void fixture_init(struct bench_fixture* f,
+                         const struct bench_config* config) {
+  f->config = *config;
+  f->events = malloc(sizeof(*f->events) * (size_t)config->events);
+  f->specs = malloc(sizeof(*f->specs) * (size_t)config->events);
+  f->handles = malloc(sizeof(*f->handles) * (size_t)config->events);
+
+  int per_timepoint = config->layout->events_per_timepoint;
+  if (per_timepoint < 0)
+    per_timepoint = (config->events - per_timepoint - 1) / -per_timepoint;
+
+  int i;
+  for (i = 0; i < config->events; ++i) {
+    f->events[i].amount = 1;
+    f->specs[i].timepoint =
+        (i / per_timepoint) * config->layout->timepoint_stride;
+    f->specs[i].phase = i % config->phases;
+    f->specs[i].evt = &f->events[i];
+    f->specs[i].evt_apply_func = (RwnEventApplyFunc)bench_event_apply;
+    f->specs[i].evt_destroy_func = NULL;
+    f->specs[i].evt_revert_func = NULL;
+    // the counter is atomic, so any split of the events is independent
+    f->specs[i].conflict_key = (uint64_t)(i % 64) + 1;
+  }
+  f->last_timepoint = f->specs[config->events - 1].timepoint;
+
+  f->alloc_stats.allocs = 0;
+  f->allocator.alloc = (void* (*)(size_t, void*))bench_alloc;
+  f->allocator.realloc =
+      (void* (*)(void*, size_t, size_t, void*))bench_realloc;
+  f->allocator.free = (void (*)(void*, size_t, void*))bench_free;
+  f->allocator.user_data = &f->alloc_stats;
+}
+
+static void fixture_fini(struct bench_fixture* f) {
+  free(f->handles);
+  free(f->specs);
+  free(f->events);
+}
+
+static RwnHistory* fixture_history(struct bench_fixture* f) {
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+  rwn_history_schedule_many(h, f->specs, f->config.events, f->handles);
+  return h;
+}
+
+static void bench_schedule(struct bench_fixture* f) {
+  f->alloc_stats.allocs = 0;
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+
+  double start = now_ns();
+  int i;
+  for (i = 0; i < f->config.events; ++i) {
+    const RwnEventSpec* spec = &f->specs[i];
+    f->handles[i] =
+        rwn_history_schedule(h, spec->timepoint, spec->phase, spec->evt,
+                             spec->evt_apply_func, spec->evt_destroy_func);
+  }
+  report(f, "schedule", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  f->alloc_stats.allocs = 0;
+  start = now_ns();
+  rwn_history_destroy(h);
+  report(f, "destroy", 0, now_ns() - start, f->alloc_stats.allocs);
+}
+
+static void bench_schedule_many(struct bench_fixture* f) {
+  f->alloc_stats.allocs = 0;
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+
+  double start = now_ns();
+  rwn_history_schedule_many(h, f->specs, f->config.events, f->handles);
+  report(f, "schedule_many", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+// every new timepoint lands in front of all indexed ones
+static void bench_schedule_reversed(struct bench_fixture* f) {
+  f->alloc_stats.allocs = 0;
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+
+  double start = now_ns();
+  int i;
+  for (i = f->config.events - 1; i >= 0; --i) {
+    const RwnEventSpec* spec = &f->specs[i];
+    f->handles[i] =
+        rwn_history_schedule(h, spec->timepoint, spec->phase, spec->evt,
+                             spec->evt_apply_func, spec->evt_destroy_func);
+  }
+  report(f, "schedule_reversed", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+static void bench_schedule_detached(struct bench_fixture* f) {
+  f->alloc_stats.allocs = 0;
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+
+  double start = now_ns();
+  int i;
+  for (i = 0; i < f->config.events; ++i) {
+    const RwnEventSpec* spec = &f->specs[i];
+    rwn_history_schedule_detached(h, spec->timepoint, spec->phase, spec->evt,
+                                  spec->evt_apply_func,
+                                  spec->evt_destroy_func);
+  }
+  report(f, "schedule_detached", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  f->alloc_stats.allocs = 0;
+  start = now_ns();
+  rwn_history_destroy(h);
+  report(f, "destroy_detached", 0, now_ns() - start, f->alloc_stats.allocs);
+}
+
+static void bench_get_events(struct bench_fixture* f) {
+  RwnHistory* h = fixture_history(f);
+  void** eventv = malloc(sizeof(*eventv) * (size_t)f->config.events);
+
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  RwnTimepoint timepoint = rwn_history_next_timepoint(h, 0);
+  while (timepoint >= 0) {
+    rwn_history_get_events(h, timepoint, eventv);
+    timepoint = rwn_history_next_timepoint(h, timepoint + 1);
+  }
+  report(f, "get_events", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  free(eventv);
+  rwn_history_destroy(h);
+}
+
+static bool bench_visit_event(const RwnEventInfo* info, long* sum) {
+  *sum += ((const struct bench_event*)info->evt)->amount;
+  return true;
+}
+
+static void bench_visit_events(struct bench_fixture* f) {
+  RwnHistory* h = fixture_history(f);
+  long sum = 0;
+
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  rwn_history_visit_events(h, 0, f->last_timepoint,
+                           (RwnEventVisitFunc)bench_visit_event, &sum);
+  report(f, "visit_events", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+static size_t bench_event_encode(const struct bench_event* e,
+                                 void* buf,
+                                 size_t buf_size,
+                                 void* user_data) {
+  if (buf_size >= sizeof(*e))
+    memcpy(buf, e, sizeof(*e));
+  return sizeof(*e);
+}
+
+static void bench_save_load(struct bench_fixture* f) {
+  static const RwnEventApplyFunc apply_funcs[] = {
+      (RwnEventApplyFunc)bench_event_apply};
+  RwnEventCodec codec;
+  codec.apply_funcs = apply_funcs;
+  codec.apply_func_count = 1;
+  codec.destroy_funcs = NULL;
+  codec.destroy_func_count = 0;
+  codec.encode =
+      (size_t(*)(const void*, void*, size_t, void*))bench_event_encode;
+  codec.decode = NULL; // events stay in the mapped file
+  codec.user_data = NULL;
+
+  RwnHistory* h = fixture_history(f);
+  char path[] = "/tmp/bench_history_XXXXXX";
+  close(mkstemp(path));
+
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  rwn_history_save(h, path, &codec);
+  report(f, "save", 0, now_ns() - start, f->alloc_stats.allocs);
+  rwn_history_destroy(h);
+
+  f->alloc_stats.allocs = 0;
+  start = now_ns();
+  h = rwn_history_load(path, &codec, &f->allocator);
+  report(f, "load", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+  unlink(path);
+}
+
+static void bench_unschedule(struct bench_fixture* f) {
+  RwnHistory* h = fixture_history(f);
+
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  int i;
+  for (i = 0; i < f->config.events; ++i)
+    rwn_history_unschedule(h, f->handles[i]);
+  report(f, "unschedule", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+static void bench_unschedule_all(struct bench_fixture* f) {
+  RwnHistory* h = fixture_history(f);
+
+  // truncate the second half of the timeline
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  rwn_history_unschedule_all(h, f->last_timepoint / 2, f->last_timepoint);
+  report(f, "unschedule_all", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+static struct bench_state* bench_shard_fork(const struct bench_state* state,
+                                            void* user_data) {
+  struct bench_state* shard = malloc(sizeof(*shard));
+  shard->value = 0;
+  return shard;
+}
+
+static void bench_shard_merge(struct bench_state* state,
+                              struct bench_state* shard,
+                              void* user_data) {
+  state->value += shard->value;
+  shard->value = 0;
+}
+
+static void bench_shard_discard(struct bench_state* shard, void* user_data) {
+  free(shard);
+}
+
+static void bench_state_delta_sharded(struct bench_fixture* f,
+                                      int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  struct bench_state state;
+  state.value = 0;
+
+  RwnStateShardFuncs funcs;
+  funcs.fork_state = (void* (*)(const void*, void*))bench_shard_fork;
+  funcs.merge_state = (void (*)(void*, void*, void*))bench_shard_merge;
+  funcs.discard_state = (void (*)(void*, void*))bench_shard_discard;
+  funcs.user_data = NULL;
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    RwnExecutor* ex = rwn_executor_create(threads);
+    f->alloc_stats.allocs = 0;
+    double start = now_ns();
+    rwn_history_state_delta_sharded(h, 0, f->last_timepoint, &state, ex,
+                                    &funcs);
+    report(f, "state_delta_sharded", threads, now_ns() - start,
+           f->alloc_stats.allocs);
+    rwn_executor_destroy(ex);
+  }
+
+  rwn_history_destroy(h);
+}
+
+static void bench_state_delta_dag(struct bench_fixture* f, int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  struct bench_state state;
+  state.value = 0;
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    RwnExecutor* ex = rwn_executor_create(threads);
+    f->alloc_stats.allocs = 0;
+    double start = now_ns();
+    rwn_history_state_delta_dag(h, 0, f->last_timepoint, &state, ex);
+    report(f, "state_delta_dag", threads, now_ns() - start,
+           f->alloc_stats.allocs);
+    rwn_executor_destroy(ex);
+  }
+
+  rwn_history_destroy(h);
+}
+
+struct bench_reader {
+  const RwnHistoryVersion* v;
+  int last_timepoint;
+  struct bench_state state;
+};
+
+static void* bench_reader_thread(struct bench_reader* r) {
+  r->state.value = 0;
+  rwn_history_version_state_delta(r->v, 0, r->last_timepoint, &r->state,
+                                  NULL);
+  return NULL;
+}
+
+/*
+ * Independent replays of one version, a thread each
+ */
+static void bench_version_replay(struct bench_fixture* f, int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  struct bench_reader* readers = malloc(sizeof(*readers) * max_threads);
+  pthread_t* tids = malloc(sizeof(*tids) * max_threads);
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    f->alloc_stats.allocs = 0;
+    double start = now_ns();
+    RwnHistoryVersion* v = rwn_history_version_create(h);
+    int i;
+    for (i = 0; i < threads; ++i) {
+      readers[i].v = v;
+      readers[i].last_timepoint = f->last_timepoint;
+      pthread_create(&tids[i], NULL, (void* (*)(void*))bench_reader_thread,
+                     &readers[i]);
+    }
+    for (i = 0; i < threads; ++i)
+      pthread_join(tids[i], NULL);
+    rwn_history_version_release(v);
+    // per event of a single replay
+    report(f, "version_replay", threads, (now_ns() - start) / threads,
+           f->alloc_stats.allocs);
+  }
+
+  free(tids);
+  free(readers);
+  rwn_history_destroy(h);
+}
+
+/*
+ * Same events as `state_delta`, inline in the history and applied in batches
+ * (or by columns)
+ */
+static void bench_state_delta_typed(struct bench_fixture* f, bool columns) {
+  RwnHistory* h = rwn_history_create_ex(&f->allocator);
+  RwnEventType type;
+  type.payload_size = sizeof(struct bench_event);
+  type.apply_func = (RwnEventApplyFunc)bench_event_apply;
+  type.revert_func = NULL;
+  type.batch_apply_func = (RwnEventBatchApplyFunc)bench_event_batch_apply;
+  int id = rwn_history_register_type(h, &type);
+  if (columns) {
+    RwnPayloadField field;
+    field.offset = 0;
+    field.size = sizeof(int);
+    rwn_history_set_type_columns(
+        h, id, &field, 1, (RwnEventColumnsApplyFunc)bench_event_columns_apply);
+  }
+  int i;
+  for (i = 0; i < f->config.events; ++i)
+    rwn_history_schedule_typed(h, f->specs[i].timepoint, f->specs[i].phase,
+                               id, &f->events[i]);
+
+  struct bench_state state;
+  state.value = 0;
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  rwn_history_state_delta_ex(h, 0, f->last_timepoint, &state, NULL);
+  report(f, columns ? "state_delta_columns" : "state_delta_typed", 0,
+         now_ns() - start, f->alloc_stats.allocs);
+
+  rwn_history_destroy(h);
+}
+
+#define BENCH_MULTI_STATES 64
+
+/*
+ * One walk over the fixture for many states, per event and state
+ */
+static void bench_state_delta_multi(struct bench_fixture* f, int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  // a cache line each, or the states would be shared after all
+  struct {
+    struct bench_state state;
+    char pad[64 - sizeof(struct bench_state)];
+  } states[BENCH_MULTI_STATES];
+  void* state_ptrs[BENCH_MULTI_STATES];
+  int i;
+  for (i = 0; i < BENCH_MULTI_STATES; ++i) {
+    states[i].state.value = 0;
+    state_ptrs[i] = &states[i].state;
+  }
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    RwnExecutor* ex = rwn_executor_create(threads);
+    f->alloc_stats.allocs = 0;
+    double start = now_ns();
+    rwn_history_state_delta_multi(h, 0, f->last_timepoint, state_ptrs,
+                                  BENCH_MULTI_STATES, ex);
+    report(f, "state_delta_multi", threads,
+           (now_ns() - start) / BENCH_MULTI_STATES, f->alloc_stats.allocs);
+    rwn_executor_destroy(ex);
+  }
+
+  rwn_history_destroy(h);
+}
+
+static void bench_state_delta(struct bench_fixture* f, int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  struct bench_state state;
+  state.value = 0;
+
+  f->alloc_stats.allocs = 0;
+  double start = now_ns();
+  rwn_history_state_delta_ex(h, 0, f->last_timepoint, &state, NULL);
+  report(f, "state_delta", 0, now_ns() - start, f->alloc_stats.allocs);
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    RwnExecutor* ex = rwn_executor_create(threads);
+    f->alloc_stats.allocs = 0;
+    start = now_ns();
+    rwn_history_state_delta_ex(h, 0, f->last_timepoint, &state, ex);
+    report(f, "state_delta", threads, now_ns() - start,
+           f->alloc_stats.allocs);
+    rwn_executor_destroy(ex);
+  }
+
+  rwn_history_destroy(h);
+}
+
+/*
+ * Same as state_delta but recording the apply calls on a deterministic
+ * executor, to show what the tracing costs
+ */
+static void bench_state_delta_traced(struct bench_fixture* f, int max_threads) {
+  RwnHistory* h = fixture_history(f);
+  struct bench_state state;
+  state.value = 0;
+
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    RwnExecutor* ex = rwn_executor_create(threads);
+    rwn_executor_set_deterministic(ex, true);
+    RwnTrace* trace = rwn_trace_create(threads, f->config.events);
+    rwn_history_set_trace(h, trace);
+    f->alloc_stats.allocs = 0;
+    double start = now_ns();
+    rwn_history_state_delta_ex(h, 0, f->last_timepoint, &state, ex);
+    report(f, "state_delta_traced", threads, now_ns() - start,
+           f->alloc_stats.allocs);
+    rwn_history_set_trace(h, NULL);
+    rwn_trace_destroy(trace);
+    rwn_executor_destroy(ex);
+  }
+
+  rwn_history_destroy(h);
+}
+
+int main(int argc, char** argv) {
+  int max_events = 1000000;
+  int max_threads = 8;
+
+  int i;
+  for (i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--max-events") == 0 && i + 1 < argc)
+      max_events = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc)
+      max_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      bench_filter = argv[++i];
+    else {
+      fprintf(stderr,
+              "usage: %s [--max-events N] [--max-threads N] [--filter CASE]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  static const int phase_counts[] = {1, 8};
+  size_t l, p;
+  for (l = 0; l < sizeof(bench_layouts) / sizeof(*bench_layouts); ++l) {
+    for (p = 0; p < sizeof(phase_counts) / sizeof(*phase_counts); ++p) {
+      int events;
+      for (events = 1000; events <= max_events; events *= 10) {
+        struct bench_config config;
+        config.layout = &bench_layouts[l];
+        config.phases = phase_counts[p];
+        config.events = events;
+
+        struct bench_fixture f;
+        fixture_init(&f, &config);
+        if (case_enabled("schedule"))
+          bench_schedule(&f);
+        if (case_enabled("schedule_many"))
+          bench_schedule_many(&f);
+        if (case_enabled("schedule_reversed"))
+          bench_schedule_reversed(&f);
+        if (case_enabled("schedule_detached"))
+          bench_schedule_detached(&f);
+        if (case_enabled("get_events"))
+          bench_get_events(&f);
+        if (case_enabled("visit_events"))
+          bench_visit_events(&f);
+        if (case_enabled("save_load"))
+          bench_save_load(&f);
+        if (case_enabled("unschedule"))
+          bench_unschedule(&f);
+        if (case_enabled("unschedule_all"))
+          bench_unschedule_all(&f);
+        if (case_enabled("state_delta"))
+          bench_state_delta(&f, max_threads);
+        if (case_enabled("state_delta_traced"))
+          bench_state_delta_traced(&f, max_threads);
+        if (case_enabled("state_delta_typed"))
+          bench_state_delta_typed(&f, false);
+        if (case_enabled("state_delta_columns"))
+          bench_state_delta_typed(&f, true);
+        if (case_enabled("state_delta_multi"))
+          bench_state_delta_multi(&f, max_threads);
+        if (case_enabled("state_delta_dag"))
+          bench_state_delta_dag(&f, max_threads);
+        if (case_enabled("state_delta_sharded"))
+          bench_state_delta_sharded(&f, max_threads);
+        if (case_enabled("version_replay"))
+          bench_version_replay(&f, max_threads);
+        fixture_fini(&f);
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
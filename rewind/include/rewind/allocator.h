@@ -0,0 +1,46 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * @brief User-supplied memory allocation hooks
+ *
+ * The library never calls them for every scheduled event: the history packs
+ * its small nodes into big blocks taken from `alloc`, and frees the blocks all
+ * at once on destroy. Any `NULL` member (or passing no allocator at all) means
+ * the standard `malloc()`, `realloc()` and `free()`.
+ */
+typedef struct RwnAllocator {
+  /** allocate at least `size` bytes, suitably aligned for any type */
+  void* (*alloc)(size_t size, void* user_data);
+  /** resize a block previously returned by `alloc` */
+  void* (*realloc)(void* ptr,
+                   size_t old_size,
+                   size_t new_size,
+                   void* user_data);
+  /** free a block previously returned by `alloc` or `realloc` */
+  void (*free)(void* ptr, size_t size, void* user_data);
+  /** passed to all of the above */
+  void* user_data;
+} RwnAllocator;
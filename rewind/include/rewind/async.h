@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+/**
+ * Where the completions of async events come from, e.g. an epoll or io_uring
+ * loop run by the applying thread (by several at once in
+ * `rwn_history_state_delta_multi()`)
+ */
+typedef struct RwnCompletionSource {
+  /** wait for completions, reporting them with `rwn_completion_done()` */
+  void (*wait)(void* user_data);
+  /** passed to `wait` */
+  void* user_data;
+} RwnCompletionSource;
+
+/**
+ * @brief Schedule an event whose apply function may return before the event
+ * is fully applied.
+ *
+ * Phases are applied as usual, but an async event which returns "pending" does
+ * not hold back the other events of its phase: they are applied right away,
+ * and the phase as a whole ends (the phase barrier) only when all of its
+ * pending events have completed. So a few threads can keep thousands of
+ * I/O-bound events in flight. The state may be modified by whoever completes
+ * the event, so the same THREADSAFE requirement holds for the events of the
+ * phase as with multithreaded phases.
+ *
+ * Async events are irreversible. They can not be saved with
+ * `rwn_history_save()`, and `rwn_history_state_delta_dag()` applies ranges
+ * containing them phase by phase.
+ *
+ * @param h
+ * @param at_timepoint
+ * @param at_phase
+ * @param evt pointer to the user's event datastructure
+ * @param evt_async_apply_func
+ * @param evt_destroy_func
+ * @return event handle, or NULL if the timepoint is negative or retired or
+ * the live handles hit their limit (see `RwnEventHandle`)
+ */
+extern RwnEventHandle* rwn_history_schedule_async(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    const void* evt,
+    RwnEventAsyncApplyFunc evt_async_apply_func,
+    RwnEventDestroyFunc evt_destroy_func);
+
+/**
+ * @brief Make the phase barriers wait for completions with the source, instead
+ * of blocking until some other thread reports them
+ * @param h
+ * @param source copied, or NULL to block
+ */
+extern void rwn_history_set_completion_source(
+    RwnHistory* h,
+    const RwnCompletionSource* source);
+
+/**
+ * @brief Report that one pending async event was fully applied. Threadsafe.
+ * @param completion the token the event was applied with
+ */
+extern void rwn_completion_done(RwnCompletion* completion);
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+/**
+ * @brief User's functions to make and restore copies (snapshots) of the state
+ */
+typedef struct RwnCheckpointFuncs {
+  /** make a snapshot of the state */
+  void* (*save)(const void* state, void* user_data);
+  /** overwrite the state with the contents of a snapshot */
+  void (*restore)(void* state, const void* snapshot, void* user_data);
+  /** free the snapshot */
+  void (*discard)(void* snapshot, void* user_data);
+  /** passed to all of the above */
+  void* user_data;
+} RwnCheckpointFuncs;
+
+/**
+ * @brief Start keeping snapshots of the state to make `rwn_history_seek()`
+ * cheap.
+ *
+ * The initial state is saved right away. Afterwards every seek saves the state
+ * at the end of each block of `interval` timepoints it replays through, unless
+ * there were no events applied since the previous checkpoint (so sparse
+ * histories do not end up with many equal snapshots).
+ *
+ * (Un)scheduling events only marks the earliest modified timepoint as dirty;
+ * the checkpoints that have seen the old events are dropped lazily by the
+ * next seek.
+ *
+ * Any previously enabled checkpoints are discarded.
+ *
+ * @param h
+ * @param funcs snapshot functions (copied)
+ * @param interval number of timepoints between checkpoints, at least one
+ * @param initial_state the state before timepoint zero
+ */
+extern void rwn_history_enable_checkpoints(RwnHistory* h,
+                                           const RwnCheckpointFuncs* funcs,
+                                           RwnTimepoint interval,
+                                           const void* initial_state);
+
+/**
+ * @brief Discard all checkpoints and stop making new ones
+ * @param h
+ */
+extern void rwn_history_disable_checkpoints(RwnHistory* h);
+
+/**
+ * @brief Count valid checkpoints (including the initial state)
+ * @param h
+ * @return number of checkpoints or zero if they are not enabled
+ */
+extern int rwn_history_count_checkpoints(const RwnHistory* h);
+
+/**
+ * @brief Bring the state to the given timepoint, that is, make it the result
+ * of applying all events at timepoints from zero to `timepoint` inclusive to
+ * the initial state.
+ *
+ * The nearest checkpoint at or before `timepoint` is restored into the state
+ * and only the remaining timepoints are replayed, sequentially. The contents
+ * of `state` before the call do not matter.
+ *
+ * @param h
+ * @param timepoint
+ * @param state the datastructure to overwrite
+ * @return number of events applied to reach the timepoint, or -1 if the
+ * checkpoints are not enabled or the timepoint is negative (or retired, see
+ * `rwn_history_retire()`)
+ */
+extern int rwn_history_seek(RwnHistory* h, RwnTimepoint timepoint, void* state);
+
+/**
+ * @brief Same as `rwn_history_seek()`, but reuses the given state if it is the
+ * result of the last seek (or reevaluation) and no events at or before its
+ * timepoint were modified since then.
+ *
+ * This makes edit-then-reevaluate loops cheap: after an edit at timepoint `t`
+ * the replay starts at the nearest checkpoint before `t`, and without edits
+ * a later timepoint is reached by continuing from the state at hand.
+ *
+ * @param h
+ * @param timepoint
+ * @param state result of the last seek, not modified by the user since
+ * @return number of events applied to reach the timepoint, or -1 if the
+ * checkpoints are not enabled or the timepoint is negative (or retired, see
+ * `rwn_history_retire()`)
+ */
+extern int rwn_history_reevaluate(RwnHistory* h,
+                                  RwnTimepoint timepoint,
+                                  void* state);
+
+/**
+ * @brief Get the earliest timepoint which had its events modified since the
+ * last seek (or reevaluation)
+ * @param h
+ * @return the timepoint or -1 if nothing was modified or the checkpoints are
+ * not enabled
+ */
+extern RwnTimepoint rwn_history_dirty_timepoint(const RwnHistory* h);
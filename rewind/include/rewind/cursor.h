@@ -0,0 +1,127 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/executor.h>
+#include <rewind/history.h>
+
+/**
+ * @brief Callbacks of a stepped replay; both optional
+ */
+typedef struct RwnStepFuncs {
+  /** after all phases of a populated timepoint unless `after_phase` stopped
+   * the replay at its last one; false stops the replay */
+  bool (*after_timepoint)(RwnTimepoint timepoint, void* state, void* user_data);
+  /** after each phase; false stops the replay before the next phase */
+  bool (*after_phase)(RwnTimepoint timepoint,
+                      int phase,
+                      void* state,
+                      void* user_data);
+  /** passed to all of the above */
+  void* user_data;
+} RwnStepFuncs;
+
+/**
+ * @brief Same as `rwn_history_state_delta_ex()` going forward, but stopping
+ * as soon as one of the callbacks says so.
+ * @param h
+ * @param start_timepoint
+ * @param finish_timepoint not less than `start_timepoint`
+ * @param state
+ * @param executor
+ * @param step_funcs
+ * @param stopped_timepoint set to the timepoint the replay was stopped at, or
+ * to -1 if it ran up to `finish_timepoint`; may be NULL
+ * @return number of applied events
+ */
+extern int rwn_history_state_delta_until(const RwnHistory* h,
+                                         RwnTimepoint start_timepoint,
+                                         RwnTimepoint finish_timepoint,
+                                         void* state,
+                                         RwnExecutor* executor,
+                                         const RwnStepFuncs* step_funcs,
+                                         RwnTimepoint* stopped_timepoint);
+
+/**
+ * Position in the history between two replays, so that stepping forward
+ * costs no new lookup
+ */
+typedef struct RwnHistoryCursor RwnHistoryCursor;
+
+/**
+ * @brief Create cursor before the given timepoint.
+ *
+ * The history may be edited between the calls on the cursor: events
+ * scheduled before its position are simply not applied. The cursor must be
+ * destroyed before the history.
+ *
+ * @param h
+ * @param timepoint first timepoint to apply
+ * @return
+ */
+extern RwnHistoryCursor* rwn_history_cursor_create(const RwnHistory* h,
+                                                   RwnTimepoint timepoint);
+
+extern void rwn_history_cursor_destroy(RwnHistoryCursor* c);
+
+/**
+ * @brief Move the cursor before the given timepoint
+ * @param c
+ * @param timepoint
+ */
+extern void rwn_history_cursor_reset(RwnHistoryCursor* c,
+                                     RwnTimepoint timepoint);
+
+/**
+ * @brief Get the first timepoint not applied yet (which may be partly
+ * applied, if a replay was stopped after one of its phases)
+ * @param c
+ * @return
+ */
+extern RwnTimepoint rwn_history_cursor_timepoint(const RwnHistoryCursor* c);
+
+/**
+ * @brief Apply the (rest of the) next populated timepoint and move past it
+ * @param c
+ * @param state
+ * @param executor
+ * @return number of applied events, or -1 if there are no timepoints left
+ */
+extern int rwn_history_cursor_step(RwnHistoryCursor* c,
+                                   void* state,
+                                   RwnExecutor* executor);
+
+/**
+ * @brief Apply the events up to the timepoint, or until one of the callbacks
+ * stops the replay, and move past them
+ * @param c
+ * @param finish_timepoint
+ * @param state
+ * @param executor
+ * @param step_funcs or NULL to run up to `finish_timepoint`
+ * @return number of applied events
+ */
+extern int rwn_history_cursor_run(RwnHistoryCursor* c,
+                                  RwnTimepoint finish_timepoint,
+                                  void* state,
+                                  RwnExecutor* executor,
+                                  const RwnStepFuncs* step_funcs);
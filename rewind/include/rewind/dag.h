@@ -0,0 +1,56 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+/**
+ * @brief Apply scheduled events to the state, overlapping independent
+ * timepoints and phases.
+ *
+ * The events in range are ordered into a dependency graph by their conflict
+ * keys (see `rwn_history_schedule_keyed()`): an event waits only for the
+ * earlier events with the same key, or for all earlier events if either of
+ * them has key zero. The graph is then run level by level on the executor, so
+ * e.g. events of timepoint `t + 1` start before `t` is over if they touch
+ * other parts of the state. The final state is the same as the one of
+ * `rwn_history_state_delta_ex()`, provided that the keys are honest.
+ *
+ * NOTE: events with different keys may run concurrently, so their `apply`
+ * functions must be THREADSAFE with respect to each other; the events of one
+ * phase are concurrent as usual.
+ *
+ * Without executor, and for backward ranges, this is exactly
+ * `rwn_history_state_delta_ex()`.
+ *
+ * @param h
+ * @param start_timepoint first timepoint to apply planned events at
+ * @param finish_timepoint last timepoint to apply planned events at
+ * @param state the datastructure that will be modified by the events
+ * @param executor pool of threads to apply the graph with, or NULL
+ * @return number of applied events
+ */
+extern int rwn_history_state_delta_dag(const RwnHistory* h,
+                                       RwnTimepoint start_timepoint,
+                                       RwnTimepoint finish_timepoint,
+                                       void* state,
+                                       RwnExecutor* executor);
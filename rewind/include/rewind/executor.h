@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <stdbool.h>
+
+/**
+ * @brief Opaque pool of worker threads that is kept alive between the calls
+ * and used to apply events of the same phase concurrently
+ */
+typedef struct RwnExecutor RwnExecutor;
+
+/**
+ * @brief Create executor with the given number of threads.
+ *
+ * The thread which submits the work (e.g. calls `rwn_history_state_delta_ex()`)
+ * takes part in the execution, so only `num_threads - 1` additional workers are
+ * spawned. Value of one means sequential execution in the calling thread.
+ *
+ * Every batch is dealt to the threads in equal chunks, and a thread which is
+ * done with its chunk steals half of the remaining work of a busy one, so
+ * uneven event costs do not leave the cores idle until the end of the phase.
+ *
+ * @param num_threads maximum number of concurrently running threads
+ * @return new executor or NULL if `num_threads` is less than one
+ */
+extern RwnExecutor* rwn_executor_create(int num_threads);
+
+/**
+ * @brief Create executor whose worker threads are pinned to the given CPUs.
+ *
+ * The spawned workers are dealt to `cpus` in order, wrapping around if there
+ * are more workers than CPUs. The submitting thread keeps its affinity: pin
+ * it to the same node as well, so that the storage it allocates while
+ * scheduling is local to the workers applying it. A worker whose CPU turns
+ * out to be unavailable runs unpinned.
+ *
+ * @param num_threads same as for `rwn_executor_create()`
+ * @param cpus CPU numbers as the OS counts them
+ * @param cpu_count
+ * @return new executor or NULL on invalid arguments (or if the platform does
+ * not support thread affinity)
+ */
+extern RwnExecutor* rwn_executor_create_pinned(int num_threads,
+                                               const int* cpus,
+                                               int cpu_count);
+
+/**
+ * @brief Create executor whose worker threads are pinned to the CPUs of the
+ * given NUMA node, see `rwn_executor_create_pinned()`
+ * @param num_threads
+ * @param node
+ * @return new executor or NULL if the node is unknown
+ */
+extern RwnExecutor* rwn_executor_create_on_node(int num_threads, int node);
+
+/**
+ * @brief Stop, join and free all worker threads of the executor
+ * @param ex
+ */
+extern void rwn_executor_destroy(RwnExecutor* ex);
+
+/**
+ * @brief Get number of threads the executor runs the work on (including the
+ * submitting thread)
+ * @param ex
+ * @return number of threads
+ */
+extern int rwn_executor_num_threads(const RwnExecutor* ex);
+
+/**
+ * @brief Get the CPU the worker thread is pinned to
+ * @param ex
+ * @param worker index in `[0, rwn_executor_num_threads())`, zero being the
+ * submitting thread
+ * @return CPU number or -1 if the worker is not pinned
+ */
+extern int rwn_executor_worker_cpu(const RwnExecutor* ex, int worker);
+
+/**
+ * @brief Run every task of a batch on a fixed worker, in a fixed order.
+ *
+ * Batches are still dealt in contiguous chunks `[n * i / T, n * (i + 1) / T)`
+ * but the workers stop stealing from each other, so a replay with a given
+ * number of events per phase calls the apply functions on the same threads
+ * every time, at the cost of load balancing. Must not be changed while a
+ * batch is running.
+ *
+ * @param ex
+ * @param deterministic
+ */
+extern void rwn_executor_set_deterministic(RwnExecutor* ex,
+                                           bool deterministic);
@@ -21,7 +21,29 @@
  */
 #pragma once
 
+#include <rewind/allocator.h>
+#include <rewind/executor.h>
+
 #include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Point in time, in whatever units the user counts it (e.g. nanosecond
+ * ticks). Only non-negative timepoints can be populated, and only the
+ * populated ones take memory or time, however sparse they are.
+ */
+#ifdef RWN_TIMEPOINT_32
+/* the REWIND_TIMEPOINT_BITS=32 build; saved files are the same either way */
+typedef int32_t RwnTimepoint;
+
+#define RWN_TIMEPOINT_MIN INT32_MIN
+#define RWN_TIMEPOINT_MAX INT32_MAX
+#else
+typedef int64_t RwnTimepoint;
+
+#define RWN_TIMEPOINT_MIN INT64_MIN
+#define RWN_TIMEPOINT_MAX INT64_MAX
+#endif
 
 /**
  * @brief Opaque object holding crucial information about all scheduled
@@ -31,7 +53,15 @@ typedef struct RwnHistory RwnHistory;
 
 /**
  * @brief Opaque handle issued upon event's scheduling and used to unschedule
- * (remove) the event afterwards
+ * (remove) the event afterwards. It is not a pointer to memory and must never
+ * be dereferenced or freed.
+ *
+ * NOTE: the handle packs an index and a generation of the event into a
+ * pointer-sized value, half of the bits each. That limits the live handles
+ * of a history to 2147483647 on 64-bit targets and to 65535 on 32-bit ones:
+ * past the limit, scheduling with a handle is refused (returns NULL) until
+ * some events are unscheduled or retired. Detached events (see
+ * `rwn_history_schedule_detached()`) take no handle and are not limited.
  */
 typedef struct RwnEventHandle RwnEventHandle;
 
@@ -47,12 +77,68 @@ typedef void (*RwnEventApplyFunc)(const void* e, void* s);
  */
 typedef void (*RwnEventDestroyFunc)(void* e);
 
+/**
+ * Completion token of the phase being applied, see `rewind/async.h`
+ */
+typedef struct RwnCompletion RwnCompletion;
+
+/**
+ * @brief Type of apply function which may finish later: returns true if the
+ * event is applied already, or false if `rwn_completion_done()` will be
+ * called with the token once it is
+ */
+typedef bool (*RwnEventAsyncApplyFunc)(const void* e,
+                                       void* s,
+                                       RwnCompletion* completion);
+
+/**
+ * @brief Description of one event for bulk scheduling, see
+ * `rwn_history_schedule()` for the meaning of the fields
+ */
+typedef struct RwnEventSpec {
+  RwnTimepoint timepoint;
+  int phase;
+  const void* evt;
+  RwnEventApplyFunc evt_apply_func;
+  RwnEventDestroyFunc evt_destroy_func;
+  RwnEventApplyFunc evt_revert_func; /* NULL if the event is irreversible */
+  uint64_t conflict_key; /* see `rwn_history_schedule_keyed()` */
+} RwnEventSpec;
+
+/**
+ * @brief Event as seen by `rwn_history_visit_events()`; valid only for the
+ * duration of the visit callback
+ */
+typedef struct RwnEventInfo {
+  RwnTimepoint timepoint;
+  int phase;
+  const void* evt;
+  RwnEventApplyFunc evt_apply_func; /* NULL for async events */
+  uint64_t conflict_key;
+  RwnEventHandle* handle; /* NULL for detached events */
+  RwnEventAsyncApplyFunc evt_async_apply_func; /* NULL for the others */
+} RwnEventInfo;
+
+/**
+ * @brief Type of visit callback; return false to stop the iteration
+ */
+typedef bool (*RwnEventVisitFunc)(const RwnEventInfo* info, void* user_data);
+
 /**
  * @brief Create history object
  * @return
  */
 extern RwnHistory* rwn_history_create(void);
 
+/**
+ * @brief Create history object which takes all of its memory from the given
+ * allocator
+ * @param allocator memory allocation hooks (copied), or NULL for the standard
+ * library ones
+ * @return
+ */
+extern RwnHistory* rwn_history_create_ex(const RwnAllocator* allocator);
+
 /**
  * @brief Destroy the history object and free any of its data structure,
  * including scheduled user's events (if such a function was provided upon
@@ -64,12 +150,26 @@ extern void rwn_history_destroy(RwnHistory* h);
 
 /**
  * @brief Count number of events planned to occur at the given timepoint
- * (including events without apply func, which will not be executed really)
+ * (including events without apply func, which will not be executed really).
+ * The count is cached, so this takes constant time.
  * @param h
  * @param at_timepoint
  * @return number of events
  */
-extern int rwn_history_count_events(const RwnHistory* h, int at_timepoint);
+extern int rwn_history_count_events(const RwnHistory* h,
+                                    RwnTimepoint at_timepoint);
+
+/**
+ * @brief Find the nearest timepoint that has events planned, searching forward
+ * from the given one. Takes logarithmic time regardless of how sparse the
+ * history is.
+ * @param h
+ * @param from_timepoint timepoint to start the search at (inclusive)
+ * @return the found timepoint or -1 if there are no events at or after
+ * `from_timepoint`
+ */
+extern RwnTimepoint rwn_history_next_timepoint(const RwnHistory* h,
+                                               RwnTimepoint from_timepoint);
 
 /**
  * @brief Get pointers to all events (the datastructures pointed to by the user)
@@ -81,9 +181,29 @@ extern int rwn_history_count_events(const RwnHistory* h, int at_timepoint);
  * @return number of events written to the vector
  */
 extern int rwn_history_get_events(const RwnHistory* h,
-                                  int at_timepoint,
+                                  RwnTimepoint at_timepoint,
                                   void** user_eventv);
 
+/**
+ * @brief Visit all events planned at the given timepoint range, in order of
+ * timepoints and phases, without copying them out or allocating anything.
+ *
+ * The history must not be modified during the visit.
+ *
+ * @param h
+ * @param start_timepoint first timepoint to visit events at
+ * @param finish_timepoint last timepoint to visit events at
+ * @param visit_func callback called for every event; returning false from it
+ * stops the visit
+ * @param user_data passed to the callback
+ * @return number of visited events
+ */
+extern int rwn_history_visit_events(const RwnHistory* h,
+                                    RwnTimepoint start_timepoint,
+                                    RwnTimepoint finish_timepoint,
+                                    RwnEventVisitFunc visit_func,
+                                    void* user_data);
+
 /**
  * @brief Apply scheduled events to the state, progressing sequentially through
  * the history time.
@@ -97,6 +217,17 @@ extern int rwn_history_get_events(const RwnHistory* h,
  * functions are considered to be THREADSAFE with respect to any modifications
  * of the state.
  *
+ * The worker threads are created anew for every call; use
+ * `rwn_history_state_delta_ex()` with a long-living executor to avoid that.
+ *
+ * If `finish_timepoint` is less than `start_timepoint`, the history is walked
+ * backwards: the `revert` functions of the events at `start_timepoint` down to
+ * `finish_timepoint` are called, phases and timepoints in reverse order, which
+ * takes the state from "after `start_timepoint`" back to "before
+ * `finish_timepoint`". All events of the range must have been scheduled with a
+ * `revert` function (see `rwn_history_schedule_reversible()`), otherwise the
+ * state is left untouched and -1 is returned.
+ *
  * @param h
  * @param start_timepoint first timepoint to apply planned events at
  * @param finish_timepoint last timepoint to apply planned events at
@@ -104,14 +235,119 @@ extern int rwn_history_get_events(const RwnHistory* h,
  * events
  * @param max_threads phase-multithreaded execution parameter, see above
  * description. Value of zero means no multithreading.
- * @return
+ * @return number of applied (or reverted) events, or -1 if the range can not
+ * be reverted
  */
 extern int rwn_history_state_delta(const RwnHistory* h,
-                                   int start_timepoint,
-                                   int finish_timepoint,
+                                   RwnTimepoint start_timepoint,
+                                   RwnTimepoint finish_timepoint,
                                    void* state,
                                    const int max_threads);
 
+/**
+ * @brief Same as `rwn_history_state_delta()`, but the events of each phase are
+ * applied by the given (already running) executor's threads.
+ *
+ * All events of a phase are handed to the executor as one batch, and the next
+ * phase starts only after the whole batch is done. The same THREADSAFE
+ * requirement on the `apply` (and `revert`) functions holds.
+ *
+ * @param h
+ * @param start_timepoint first timepoint to apply planned events at
+ * @param finish_timepoint last timepoint to apply planned events at
+ * @param state the datastructure that will be successively modified by the
+ * events
+ * @param executor pool of threads to apply the phases with, or NULL for
+ * single-thread, sequential execution
+ * @return number of applied (or reverted) events, or -1 if the range can not
+ * be reverted
+ */
+extern int rwn_history_state_delta_ex(const RwnHistory* h,
+                                      RwnTimepoint start_timepoint,
+                                      RwnTimepoint finish_timepoint,
+                                      void* state,
+                                      RwnExecutor* executor);
+
+/**
+ * @brief User callbacks for applying a phase to private per-thread copies
+ * (shards) of the state, see `rwn_history_state_delta_sharded()`
+ */
+typedef struct RwnStateShardFuncs {
+  /** make new shard for one thread; called in the submitting thread */
+  void* (*fork_state)(const void* state, void* user_data);
+  /** fold the shard into the state and reset the shard to its forked value */
+  void (*merge_state)(void* state, void* shard, void* user_data);
+  /** free the shard */
+  void (*discard_state)(void* shard, void* user_data);
+  /** passed to all of the above */
+  void* user_data;
+} RwnStateShardFuncs;
+
+/**
+ * @brief Same as `rwn_history_state_delta_ex()`, but the threads never share
+ * the state.
+ *
+ * Every executor thread applies its share of a phase to its own shard of the
+ * state, made by `fork_state`, and at the end of the phase all shards which
+ * received events are merged into the state with `merge_state`, in the thread
+ * order. The `apply` (and `revert`) functions need no locking then, but the
+ * events of a phase must commute and see only their shard: this suits
+ * additive events such as counters and accumulators. The shards are forked
+ * once per call and discarded before returning.
+ *
+ * Without executor, or with a single-thread one, this is exactly
+ * `rwn_history_state_delta_ex()` and no shards are made.
+ *
+ * @param h
+ * @param start_timepoint first timepoint to apply planned events at
+ * @param finish_timepoint last timepoint to apply planned events at
+ * @param state the datastructure into which the shards are merged
+ * @param executor pool of threads to apply the phases with, or NULL
+ * @param shard_funcs callbacks to fork, merge and discard the shards
+ * @return number of applied (or reverted) events, or -1 if the range can not
+ * be reverted
+ */
+extern int rwn_history_state_delta_sharded(
+    const RwnHistory* h,
+    RwnTimepoint start_timepoint,
+    RwnTimepoint finish_timepoint,
+    void* state,
+    RwnExecutor* executor,
+    const RwnStateShardFuncs* shard_funcs);
+
+/**
+ * @brief Same as `rwn_history_state_delta_ex()` for many independent states
+ * at once.
+ *
+ * The timeline is walked once, in segments of about a thousand events, and
+ * every segment is applied to all of the states before moving on, so the
+ * events stay in the cache. The states are the unit of parallelism: each
+ * state is updated by one thread at a time, the events in their usual order,
+ * so the `apply` (and `revert`) functions need not be THREADSAFE, only
+ * reentrant for distinct states.
+ *
+ * NOTE: with an executor, the `wait` of the completion source (see
+ * `rwn_history_set_completion_source()`) is called by every worker waiting
+ * for the async events of its own state, concurrently, so the source has to be
+ * THREADSAFE. A completion may be reaped by any of the waits.
+ *
+ * @param h
+ * @param start_timepoint first timepoint to apply planned events at
+ * @param finish_timepoint last timepoint to apply planned events at
+ * @param states `state_count` datastructures to modify
+ * @param state_count
+ * @param executor pool of threads to spread the states over, or NULL to apply
+ * to them one after another
+ * @return number of events applied (or reverted) to each state, or -1 if the
+ * range can not be reverted
+ */
+extern int rwn_history_state_delta_multi(const RwnHistory* h,
+                                         RwnTimepoint start_timepoint,
+                                         RwnTimepoint finish_timepoint,
+                                         void* const* states,
+                                         int state_count,
+                                         RwnExecutor* executor);
+
 /**
  * @brief Plan an event occurence at the given time point.
  * @param h
@@ -124,30 +360,187 @@ extern int rwn_history_state_delta(const RwnHistory* h,
  * @param evt_destroy_func pointer to user's `destroy` function for this event,
  * or NULL if no use
  * @return handle to the newly scheduled event that can be used later to
- * unschedule it
+ * unschedule it, or NULL if the timepoint is negative or retired or the live
+ * handles hit their limit (see `RwnEventHandle`)
  */
 extern RwnEventHandle* rwn_history_schedule(
     RwnHistory* h,
-    int at_timepoint,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    const void* evt,
+    RwnEventApplyFunc evt_apply_func,
+    RwnEventDestroyFunc evt_destroy_func);
+
+/**
+ * @brief Plan an event occurence which will never be unscheduled on its own.
+ *
+ * Same as `rwn_history_schedule()`, but no handle is issued, which saves its
+ * bookkeeping for every event. The event is still unscheduled along with its
+ * timepoint (by `rwn_history_unschedule_all()`, retirement or destruction),
+ * and `rwn_history_visit_events()` reports it with a NULL handle.
+ *
+ * @param h
+ * @param at_timepoint
+ * @param at_phase
+ * @param evt pointer to the user's event datastructure
+ * @param evt_apply_func pointer to user's `apply` function for this event
+ * @param evt_destroy_func pointer to user's `destroy` function for this event,
+ * or NULL if no use
+ * @return false if the timepoint is retired already
+ */
+extern bool rwn_history_schedule_detached(RwnHistory* h,
+                                          RwnTimepoint at_timepoint,
+                                          int at_phase,
+                                          const void* evt,
+                                          RwnEventApplyFunc evt_apply_func,
+                                          RwnEventDestroyFunc evt_destroy_func);
+
+/**
+ * @brief Plan a reversible event occurence at the given time point.
+ *
+ * Same as `rwn_history_schedule()`, but the event also carries a `revert`
+ * function which undoes on the state exactly what `apply` did. Histories made
+ * only of reversible events can be walked backwards with
+ * `rwn_history_state_delta()` without any state snapshots.
+ *
+ * @param h
+ * @param at_timepoint
+ * @param at_phase
+ * @param evt pointer to the user's event datastructure
+ * @param evt_apply_func pointer to user's `apply` function for this event
+ * @param evt_revert_func pointer to user's `revert` function for this event,
+ * the inverse of `evt_apply_func`
+ * @param evt_destroy_func pointer to user's `destroy` function for this event,
+ * or NULL if no use
+ * @return handle to the newly scheduled event, or NULL if refused as with
+ * `rwn_history_schedule()`
+ */
+extern RwnEventHandle* rwn_history_schedule_reversible(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
     int at_phase,
     const void* evt,
     RwnEventApplyFunc evt_apply_func,
+    RwnEventApplyFunc evt_revert_func,
     RwnEventDestroyFunc evt_destroy_func);
 
 /**
- * @brief Delete event occurence from the calendar
+ * @brief Plan an event occurence which touches only the part of the state
+ * named by `conflict_key`.
+ *
+ * Events with different non-zero keys are declared independent: they read and
+ * write disjoint parts of the state, so `rwn_history_state_delta_dag()` may
+ * apply them concurrently even when they are at different timepoints or
+ * phases. Events sharing a key keep their sequential order. Key zero (what
+ * `rwn_history_schedule()` uses) conflicts with every other event.
+ *
+ * @param h
+ * @param at_timepoint
+ * @param at_phase
+ * @param conflict_key the part of the state the event reads and writes, or
+ * zero for all of the state
+ * @param evt pointer to the user's event datastructure
+ * @param evt_apply_func pointer to user's `apply` function for this event
+ * @param evt_destroy_func pointer to user's `destroy` function for this event,
+ * or NULL if no use
+ * @return handle to the newly scheduled event, or NULL if refused as with
+ * `rwn_history_schedule()`
+ */
+extern RwnEventHandle* rwn_history_schedule_keyed(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    uint64_t conflict_key,
+    const void* evt,
+    RwnEventApplyFunc evt_apply_func,
+    RwnEventDestroyFunc evt_destroy_func);
+
+/**
+ * @brief Plan many event occurences at once.
+ *
+ * Same as calling `rwn_history_schedule()` for every spec in order, but the
+ * specs are sorted only once, the storage of every timepoint and phase is
+ * sized for all of its new events upfront, and new timepoints are merged into
+ * the history in a single pass.
+ *
+ * @param h
+ * @param specs array of `count` event descriptions
+ * @param count
+ * @param handles optional array of `count` elements which receives the handle
+ * of every scheduled event (NULL for the refused specs, as with
+ * `rwn_history_schedule()`), or NULL
+ * @return number of events actually scheduled, less than `count` if some
+ * were refused
+ */
+extern int rwn_history_schedule_many(RwnHistory* h,
+                                     const RwnEventSpec* specs,
+                                     int count,
+                                     RwnEventHandle** handles);
+
+/**
+ * @brief Same as `rwn_history_schedule_many()`, but the events are detached
+ * as with `rwn_history_schedule_detached()`
+ * @param h
+ * @param specs array of `count` event descriptions
+ * @param count
+ * @return number of events actually scheduled
+ */
+extern int rwn_history_schedule_many_detached(RwnHistory* h,
+                                              const RwnEventSpec* specs,
+                                              int count);
+
+/**
+ * @brief Stage events for scheduling from any thread.
+ *
+ * This is the only function which can be called concurrently with anything
+ * else on the history: the specs are copied to a lock-free staging list, so
+ * producers never block each other nor the thread which owns the history.
+ * The events are scheduled by the next `rwn_history_flush()` (or seek,
+ * reevaluation or destruction) in the order of posting; the events of one
+ * producer keep their order. The events are detached, see
+ * `rwn_history_schedule_detached()`.
+ *
+ * NOTE: the staging copies are taken from the history's allocator, which
+ * must then be THREADSAFE (the standard one is).
+ *
+ * @param h
+ * @param specs array of `count` event descriptions
+ * @param count
+ */
+extern void rwn_history_post(RwnHistory* h,
+                             const RwnEventSpec* specs,
+                             int count);
+
+/**
+ * @brief Schedule all events staged by `rwn_history_post()` so far, as one
+ * `rwn_history_schedule_many_detached()` batch. Must be called by the thread
+ * which owns the history.
+ * @param h
+ * @return number of events scheduled
+ */
+extern int rwn_history_flush(RwnHistory* h);
+
+/**
+ * @brief Delete event occurence from the calendar. Takes constant time.
+ *
+ * Handles of unscheduled events become stale, and are never mistaken for the
+ * handles of events scheduled later; passing a stale handle is a no-op. The
+ * order of the remaining events of the same phase may change.
+ *
  * @param h
  * @param eh event handle previously acquired via `rwn_history_schedule()`
  */
 extern void rwn_history_unschedule(RwnHistory* h, RwnEventHandle* eh);
 
 /**
- * @brief Delete all event occurences at the given time point
+ * @brief Delete all event occurences at the given time point range. Only the
+ * populated timepoints of the range are visited, and their storage is released
+ * in bulk.
  * @param h
  * @param start_timepoint first timepoint to delete all events at
  * @param finish_timepoint last timepoint to delete all events at
  * @return number of events that were actually unscheduled in the process
  */
 extern int rwn_history_unschedule_all(RwnHistory* h,
-                                      int start_timepoint,
-                                      int finish_timepoint);
+                                      RwnTimepoint start_timepoint,
+                                      RwnTimepoint finish_timepoint);
@@ -21,4 +21,16 @@
  */
 #pragma once
 
+#include <rewind/allocator.h>
+#include <rewind/async.h>
+#include <rewind/checkpoint.h>
+#include <rewind/cursor.h>
+#include <rewind/dag.h>
+#include <rewind/executor.h>
 #include <rewind/history.h>
+#include <rewind/serialize.h>
+#include <rewind/stats.h>
+#include <rewind/trace.h>
+#include <rewind/types.h>
+#include <rewind/version.h>
+#include <rewind/window.h>
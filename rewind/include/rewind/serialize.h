@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/allocator.h>
+#include <rewind/history.h>
+
+#include <stddef.h>
+
+/**
+ * @brief How to store the events of a history in a file and get them back.
+ *
+ * Functions can not be stored, so every function an event may use is given
+ * an ID: its index in `apply_funcs` (for both `apply` and `revert` functions)
+ * or in `destroy_funcs`. Saving and loading must use the same tables.
+ */
+typedef struct RwnEventCodec {
+  const RwnEventApplyFunc* apply_funcs;
+  int apply_func_count;
+  const RwnEventDestroyFunc* destroy_funcs;
+  int destroy_func_count;
+  /**
+   * write the payload of the event to `buf` if it fits in `buf_size` bytes;
+   * return the size of the payload either way, so that a bigger buffer can
+   * be tried. NULL stores the events without payload
+   */
+  size_t (*encode)(const void* evt, void* buf, size_t buf_size,
+                   void* user_data);
+  /**
+   * make a new event out of the payload; NULL makes every loaded event point
+   * right into the mapped file (see `rwn_history_load()`)
+   */
+  void* (*decode)(const void* payload, size_t size, void* user_data);
+  /** passed to all of the above */
+  void* user_data;
+} RwnEventCodec;
+
+/**
+ * @brief Write all events of the history to a file.
+ *
+ * The file is laid out for mapping into memory: a header, then the sorted
+ * timepoint records, the phase records of all timepoints, the event records
+ * of all phases and finally the payloads, each section contiguous and
+ * 8-byte aligned. The format is native to the machine (byte order, sizes).
+ *
+ * @param h
+ * @param path
+ * @param codec encoder and function IDs
+ * @return number of saved events, or -1 on I/O error or if an event uses a
+ * function missing from the codec tables (or is async)
+ */
+extern int rwn_history_save(const RwnHistory* h,
+                            const char* path,
+                            const RwnEventCodec* codec);
+
+/**
+ * @brief Same as `rwn_history_save()`, but only the events at the given range
+ * of timepoints are written
+ * @param h
+ * @param start_timepoint
+ * @param finish_timepoint
+ * @param path
+ * @param codec encoder and function IDs
+ * @return number of saved events, or -1 on error
+ */
+extern int rwn_history_save_range(const RwnHistory* h,
+                                  RwnTimepoint start_timepoint,
+                                  RwnTimepoint finish_timepoint,
+                                  const char* path,
+                                  const RwnEventCodec* codec);
+
+/**
+ * @brief Create a history out of a file written by `rwn_history_save()`.
+ *
+ * The file is mapped, checked and its records are fed to the history in one
+ * bulk pass (as in `rwn_history_schedule_many_detached()`), without sorting
+ * or looking up anything per event. The loaded events are detached: no
+ * handles are issued for them, and they go with their timepoints.
+ *
+ * If the codec has no `decode` function, the events are not copied at all:
+ * the event pointers point to the payloads inside the mapping, which then
+ * lives until `rwn_history_destroy()`. The destroy functions of such events
+ * are not restored, as there is nothing to free.
+ *
+ * @param path
+ * @param codec decoder and function IDs
+ * @param allocator storage for the history, or NULL for the standard one
+ * @return new history, or NULL if the file can not be read or is malformed
+ */
+extern RwnHistory* rwn_history_load(const char* path,
+                                    const RwnEventCodec* codec,
+                                    const RwnAllocator* allocator);
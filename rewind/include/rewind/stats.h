@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Statistics are collected only if the library is built with the REWIND_STATS
+ * CMake option (which defines RWN_STATS); otherwise the hot paths carry no
+ * instrumentation at all and `rwn_history_stats()` reports nothing.
+ */
+
+#define RWN_LATENCY_BUCKETS 32
+
+/**
+ * @brief Latency distribution; bucket `i` counts the samples in
+ * `[2^i, 2^(i+1))` nanoseconds (the first one also counts zero, the last one
+ * everything above)
+ */
+typedef struct RwnLatencyHistogram {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t buckets[RWN_LATENCY_BUCKETS];
+} RwnLatencyHistogram;
+
+/**
+ * @brief Events applied at one phase number, over all timepoints
+ */
+typedef struct RwnPhaseStats {
+  int phase;
+  uint64_t events_applied;
+  RwnLatencyHistogram apply_latency; /* of single events or batches */
+} RwnPhaseStats;
+
+/**
+ * @brief Events applied with one `apply` (or `revert`) function
+ */
+typedef struct RwnApplyFuncStats {
+  RwnEventApplyFunc func; /* NULL for all of the async events */
+  uint64_t events_applied;
+  RwnLatencyHistogram apply_latency; /* of single events or batches */
+} RwnApplyFuncStats;
+
+typedef struct RwnHistoryStats {
+  uint64_t events_scheduled;
+  uint64_t events_unscheduled;
+  uint64_t events_applied;
+  /* timepoints of state delta ranges with and without events */
+  uint64_t timepoints_visited;
+  uint64_t timepoints_empty;
+  uint64_t phases_applied;
+  /* phases handed to an executor, each ending with a barrier */
+  uint64_t barrier_waits;
+  /* executor threads woken up for those phases */
+  uint64_t thread_dispatches;
+
+  RwnLatencyHistogram schedule_latency;
+  RwnLatencyHistogram unschedule_latency;
+  RwnLatencyHistogram state_delta_latency;
+
+  /* sorted by phase; valid until the next call on the history */
+  const RwnPhaseStats* phases;
+  int phase_count;
+  /* sorted by function address; valid until the next call on the history */
+  const RwnApplyFuncStats* apply_funcs;
+  int apply_func_count;
+} RwnHistoryStats;
+
+/**
+ * @brief Get the statistics collected since the creation of the history or
+ * the last `rwn_history_reset_stats()`.
+ *
+ * Covers `rwn_history_schedule()` (and its variants),
+ * `rwn_history_unschedule()` and the `rwn_history_state_delta()` family.
+ *
+ * @param h
+ * @param stats receives the statistics (zeroed if not collected)
+ * @return false if the library was built without statistics
+ */
+extern bool rwn_history_stats(const RwnHistory* h, RwnHistoryStats* stats);
+
+/**
+ * @brief Zero all statistics of the history
+ * @param h
+ */
+extern void rwn_history_reset_stats(RwnHistory* h);
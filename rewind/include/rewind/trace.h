@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief One apply call seen during a replay
+ */
+typedef struct RwnTraceRecord {
+  RwnTimepoint timepoint;
+  int phase;
+  int event; /* index of the (first) event in its phase */
+  int event_count; /* more than one for a batch of typed events */
+  int worker; /* executor thread, zero for sequential replays */
+  uint64_t start_ns; /* monotonic clock */
+  uint64_t end_ns;
+} RwnTraceRecord;
+
+/**
+ * @brief Opaque set of ring buffers, one per executor thread, which keep the
+ * latest records of the replays of a history
+ */
+typedef struct RwnTrace RwnTrace;
+
+/**
+ * @brief Create trace
+ * @param worker_count number of executor threads to keep the records of (see
+ * `rwn_executor_num_threads()`); the records of the other threads are dropped
+ * @param capacity number of records every thread keeps before overwriting its
+ * oldest ones
+ * @return new trace or NULL if either number is less than one
+ */
+extern RwnTrace* rwn_trace_create(int worker_count, int capacity);
+
+extern void rwn_trace_destroy(RwnTrace* trace);
+
+/**
+ * @brief Forget all records
+ * @param trace
+ */
+extern void rwn_trace_clear(RwnTrace* trace);
+
+/**
+ * @brief Record every apply call of the replays of the history, or stop
+ * recording.
+ *
+ * Covers `rwn_history_state_delta_ex()` and everything built on it (sharded
+ * replays, seeks, cursors), but not the versions or multi-state replays. The
+ * trace must not be read, cleared or shared with another history while a
+ * replay is running.
+ *
+ * @param h
+ * @param trace or NULL to stop
+ * @return false if the library is built without the REWIND_TRACE CMake
+ * option, in which case nothing is ever recorded
+ */
+extern bool rwn_history_set_trace(RwnHistory* h, RwnTrace* trace);
+
+/**
+ * @brief Get number of records kept
+ * @param trace
+ * @return at most `worker_count * capacity`
+ */
+extern int rwn_trace_count(const RwnTrace* trace);
+
+/**
+ * @brief Get number of records lost to overwriting or to threads beyond
+ * `worker_count`
+ * @param trace
+ * @return
+ */
+extern uint64_t rwn_trace_dropped(const RwnTrace* trace);
+
+/**
+ * @brief Copy the kept records, sorted by start time (ties broken by worker)
+ * @param trace
+ * @param records array of at least `rwn_trace_count()` elements
+ * @return number of copied records
+ */
+extern int rwn_trace_records(const RwnTrace* trace, RwnTraceRecord* records);
+
+/**
+ * @brief Write the kept records in the Chrome trace event format (complete
+ * "X" events, one track per worker), viewable in chrome://tracing or Perfetto
+ * @param trace
+ * @param path
+ * @return false if the file could not be written
+ */
+extern bool rwn_trace_save_chrome(const RwnTrace* trace, const char* path);
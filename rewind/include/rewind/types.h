@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+#include <stddef.h>
+
+/**
+ * @brief Apply (in order) `count` payloads of one type, laid out as an array
+ * @param payloads first of the payloads, each `payload_size` bytes
+ * @param count
+ * @param state
+ */
+typedef void (*RwnEventBatchApplyFunc)(const void* payloads,
+                                       int count,
+                                       void* state);
+
+/**
+ * Event type whose payloads are kept by the history itself
+ */
+typedef struct RwnEventType {
+  /** bytes copied from the payload on scheduling, e.g. sizeof the struct */
+  size_t payload_size;
+  /** called with the payload as the event */
+  RwnEventApplyFunc apply_func;
+  /** inverse of `apply_func`, or NULL if the events are irreversible */
+  RwnEventApplyFunc revert_func;
+  /** same as calling `apply_func` on each payload, or NULL */
+  RwnEventBatchApplyFunc batch_apply_func;
+} RwnEventType;
+
+/**
+ * @brief Register an event type with the history
+ * @param h
+ * @param type
+ * @return type id for `rwn_history_schedule_typed()`, or -1 if the type has
+ * no payload or no `apply_func`
+ */
+extern int rwn_history_register_type(RwnHistory* h, const RwnEventType* type);
+
+/**
+ * @brief Schedule an event of a registered type.
+ *
+ * The payload is copied into the history, next to the payloads of the other
+ * typed events of the same phase, so nothing has to be allocated or
+ * destroyed by the user. When phases are applied sequentially, every run of
+ * payloads of one type scheduled back to back is applied with a single call
+ * of the type's `batch_apply_func` instead of one `apply_func` call per
+ * event.
+ *
+ * The event pointers reported for typed events (e.g. by
+ * `rwn_history_get_events()`) point to the history's copies and are valid
+ * until the next edit of their phase.
+ *
+ * @param h
+ * @param at_timepoint
+ * @param at_phase
+ * @param type id returned by `rwn_history_register_type()`
+ * @param payload `payload_size` bytes to copy
+ * @return event handle, or NULL if the timepoint is negative or retired or
+ * the live handles hit their limit (see `RwnEventHandle`)
+ */
+extern RwnEventHandle* rwn_history_schedule_typed(RwnHistory* h,
+                                                  RwnTimepoint at_timepoint,
+                                                  int at_phase,
+                                                  int type,
+                                                  const void* payload);
+
+/**
+ * Most fields of a payload which can be laid out as columns
+ */
+#define RWN_MAX_PAYLOAD_FIELDS 16
+
+/**
+ * Field of a payload struct, e.g. `{offsetof(T, x), sizeof(((T*)0)->x)}`
+ */
+typedef struct RwnPayloadField {
+  size_t offset;
+  size_t size;
+} RwnPayloadField;
+
+/**
+ * @brief Apply (in order) `count` payloads of one type, given as columns
+ * @param columns one array per registered field: `count` values each, packed
+ * back to back and aligned to 32 bytes
+ * @param count
+ * @param state
+ */
+typedef void (*RwnEventColumnsApplyFunc)(const void* const* columns,
+                                         int count,
+                                         void* state);
+
+/**
+ * @brief Have the runs of payloads of a type applied column by column.
+ *
+ * Where `batch_apply_func` would be called (see
+ * `rwn_history_schedule_typed()`), the fields of the run are copied into
+ * columns (structure of arrays) and `columns_apply_func` is called instead,
+ * so it can process one field of many events with vector instructions. Long
+ * runs are split into chunks which stay in the L1 cache, so one run may take
+ * several calls.
+ *
+ * @param h
+ * @param type id returned by `rwn_history_register_type()`
+ * @param fields the fields the kernel needs, in the order of `columns`
+ * @param field_count up to `RWN_MAX_PAYLOAD_FIELDS`
+ * @param columns_apply_func
+ * @return 0, or -1 if the fields do not fit the payload or take more than 512
+ * bytes together
+ */
+extern int rwn_history_set_type_columns(
+    RwnHistory* h,
+    int type,
+    const RwnPayloadField* fields,
+    int field_count,
+    RwnEventColumnsApplyFunc columns_apply_func);
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/executor.h>
+#include <rewind/history.h>
+
+/**
+ * Immutable snapshot of the events of a history
+ */
+typedef struct RwnHistoryVersion RwnHistoryVersion;
+
+/**
+ * @brief Take a snapshot of the events scheduled so far (posted ones are
+ * flushed first).
+ *
+ * Timepoints are copied on write: a timepoint not edited since the previous
+ * version is shared with it, so a version costs one pointer per populated
+ * timepoint plus a copy of the timepoints edited in between.
+ *
+ * The version is independent of the history afterwards: any number of
+ * threads can evaluate it while the owner keeps editing the history, with no
+ * locks taken on either side. The version does not own the events though:
+ * the event data must stay valid until the versions referring to it are
+ * released (mind the destroy functions, which still run on unscheduling).
+ * The history's allocator must be THREADSAFE, as versions are released from
+ * whichever thread.
+ *
+ * @param h
+ * @return the version, to be released with `rwn_history_version_release()`
+ */
+extern RwnHistoryVersion* rwn_history_version_create(RwnHistory* h);
+
+/**
+ * @brief Free the version; timepoints shared with newer versions stay
+ * @param v
+ */
+extern void rwn_history_version_release(RwnHistoryVersion* v);
+
+/**
+ * @brief Same as `rwn_history_state_delta_ex()`, but over the snapshot.
+ * Threadsafe: each thread passes its own state (and executor, if any).
+ * @param v
+ * @param start_timepoint
+ * @param finish_timepoint
+ * @param state
+ * @param executor running executor, or NULL to apply sequentially
+ * @return number of events applied, or -1 as with `rwn_history_state_delta()`
+ */
+extern int rwn_history_version_state_delta(const RwnHistoryVersion* v,
+                                           RwnTimepoint start_timepoint,
+                                           RwnTimepoint finish_timepoint,
+                                           void* state,
+                                           RwnExecutor* executor);
+
+/**
+ * @brief Get the count of events in the snapshot at the timepoint
+ * @param v
+ * @param at_timepoint
+ * @return
+ */
+extern int rwn_history_version_count_events(const RwnHistoryVersion* v,
+                                            RwnTimepoint at_timepoint);
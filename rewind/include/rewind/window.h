@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+
+/**
+ * @brief Called with the range of populated timepoints about to be retired,
+ * while their events are still in the history (e.g. to spill them with
+ * `rwn_history_save_range()`)
+ */
+typedef void (*RwnRetireFunc)(const RwnHistory* h,
+                              RwnTimepoint first_timepoint,
+                              RwnTimepoint last_timepoint,
+                              void* user_data);
+
+/**
+ * @brief Keep only the recent past of the history.
+ *
+ * Whenever scheduling would make the history span more than two windows, all
+ * timepoints older than the last `window` ones (counting back from the latest
+ * populated or scheduled timepoint) are retired first, see
+ * `rwn_history_retire()`, and the new events which fall behind are refused.
+ * So the memory of a long running history stays proportional to the window,
+ * and the retirement cost is amortized over a window worth of timepoints.
+ *
+ * @param h
+ * @param window number of timepoints to keep, or zero to stop retiring
+ * automatically
+ * @param retire_func called before every retirement, or NULL
+ * @param user_data passed to `retire_func`
+ */
+extern void rwn_history_set_window(RwnHistory* h,
+                                   RwnTimepoint window,
+                                   RwnRetireFunc retire_func,
+                                   void* user_data);
+
+/**
+ * @brief Drop all timepoints before the watermark for good.
+ *
+ * Their events are destroyed and their storage goes back to the history's
+ * arena. Unlike `rwn_history_unschedule_all()`, this is not an edit of the
+ * past: the checkpoints stay valid. The watermark never goes back, and
+ * scheduling at a retired timepoint is refused (as with negative ones).
+ *
+ * With checkpoints enabled, the watermark stops right after the latest valid
+ * checkpoint at or before `watermark - 1`, which becomes the oldest one kept:
+ * seeking before it is no longer possible.
+ *
+ * @param h
+ * @param watermark first timepoint to keep
+ * @return number of retired events
+ */
+extern int rwn_history_retire(RwnHistory* h, RwnTimepoint watermark);
+
+/**
+ * @brief Get the first timepoint not retired yet
+ * @param h
+ * @return the watermark, zero if nothing was retired
+ */
+extern RwnTimepoint rwn_history_watermark(const RwnHistory* h);
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Header of every block; padded so that the nodes carved after it stay
+ * cache line aligned
+ */
+struct ArenaBlock {
+  struct ArenaBlock* next;
+  char pad[64 - sizeof(struct ArenaBlock*)];
+};
+
+#define ARENA_MAX_CLASS_SIZE \
+  ((size_t)1 << (ARENA_MIN_CLASS_SHIFT + ARENA_NUM_CLASSES - 1))
+
+static void* default_alloc(size_t size, void* user_data) {
+  (void)user_data;
+  return malloc(size);
+}
+
+static void* default_realloc(void* ptr,
+                             size_t old_size,
+                             size_t new_size,
+                             void* user_data) {
+  (void)old_size;
+  (void)user_data;
+  return realloc(ptr, new_size);
+}
+
+static void default_free(void* ptr, size_t size, void* user_data) {
+  (void)size;
+  (void)user_data;
+  free(ptr);
+}
+
+void* rwn_allocator_alloc(const RwnAllocator* allocator, size_t size) {
+  return allocator->alloc(size, allocator->user_data);
+}
+
+void rwn_allocator_free(const RwnAllocator* allocator, void* ptr, size_t size) {
+  if (ptr != NULL)
+    allocator->free(ptr, size, allocator->user_data);
+}
+
+static int size_class(size_t size) {
+  int cls = 0;
+  while (((size_t)1 << (ARENA_MIN_CLASS_SHIFT + cls)) < size)
+    cls += 1;
+  return cls;
+}
+
+void rwn_arena_init(struct Arena* arena, const RwnAllocator* allocator) {
+  arena->allocator.alloc = default_alloc;
+  arena->allocator.realloc = default_realloc;
+  arena->allocator.free = default_free;
+  arena->allocator.user_data = NULL;
+  if (allocator != NULL) {
+    arena->allocator.user_data = allocator->user_data;
+    if (allocator->alloc != NULL && allocator->free != NULL) {
+      arena->allocator.alloc = allocator->alloc;
+      arena->allocator.free = allocator->free;
+      // a user realloc only makes sense together with the user alloc/free
+      arena->allocator.realloc = allocator->realloc;
+    }
+  }
+
+  memset(arena->free_lists, 0, sizeof(arena->free_lists));
+  arena->bump_ptr = NULL;
+  arena->bump_end = NULL;
+  arena->blocks = NULL;
+}
+
+void rwn_arena_release(struct Arena* arena) {
+  struct ArenaBlock* block = arena->blocks;
+  while (block != NULL) {
+    struct ArenaBlock* next = block->next;
+    rwn_allocator_free(&arena->allocator, block, ARENA_BLOCK_SIZE);
+    block = next;
+  }
+
+  memset(arena->free_lists, 0, sizeof(arena->free_lists));
+  arena->bump_ptr = NULL;
+  arena->bump_end = NULL;
+  arena->blocks = NULL;
+}
+
+void* rwn_arena_alloc(struct Arena* arena, size_t size) {
+  if (size > ARENA_MAX_CLASS_SIZE)
+    return rwn_allocator_alloc(&arena->allocator, size);
+
+  int cls = size_class(size);
+  void* node = arena->free_lists[cls];
+  if (node != NULL) {
+    arena->free_lists[cls] = *(void**)node;
+    return node;
+  }
+
+  size_t class_size = (size_t)1 << (ARENA_MIN_CLASS_SHIFT + cls);
+  if (arena->bump_ptr == NULL ||
+      (size_t)(arena->bump_end - arena->bump_ptr) < class_size) {
+    struct ArenaBlock* block =
+        rwn_allocator_alloc(&arena->allocator, ARENA_BLOCK_SIZE);
+    if (block == NULL)
+      return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->bump_ptr = (char*)(block + 1);
+    arena->bump_end = (char*)block + ARENA_BLOCK_SIZE;
+  }
+
+  node = arena->bump_ptr;
+  arena->bump_ptr += class_size;
+  return node;
+}
+
+void rwn_arena_free(struct Arena* arena, void* ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+
+  if (size > ARENA_MAX_CLASS_SIZE) {
+    rwn_allocator_free(&arena->allocator, ptr, size);
+    return;
+  }
+
+  int cls = size_class(size);
+  *(void**)ptr = arena->free_lists[cls];
+  arena->free_lists[cls] = ptr;
+}
+
+void* rwn_arena_realloc(struct Arena* arena,
+                        void* ptr,
+                        size_t old_size,
+                        size_t new_size) {
+  if (ptr == NULL)
+    return rwn_arena_alloc(arena, new_size);
+
+  // both large: let the allocator grow it in place if it can
+  if (old_size > ARENA_MAX_CLASS_SIZE && new_size > ARENA_MAX_CLASS_SIZE &&
+      arena->allocator.realloc != NULL)
+    return arena->allocator.realloc(ptr, old_size, new_size,
+                                    arena->allocator.user_data);
+
+  // same size class: nothing to do
+  if (old_size <= ARENA_MAX_CLASS_SIZE && new_size <= ARENA_MAX_CLASS_SIZE &&
+      size_class(old_size) == size_class(new_size))
+    return ptr;
+
+  void* new_ptr = rwn_arena_alloc(arena, new_size);
+  if (new_ptr == NULL)
+    return NULL;
+  memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+  rwn_arena_free(arena, ptr, old_size);
+
+  return new_ptr;
+}
+
+void* rwn_arena_reserve(struct Arena* arena,
+                        void* array,
+                        int needed,
+                        int* capacity,
+                        size_t elem_size) {
+  if (needed <= *capacity)
+    return array;
+
+  int old_capacity = *capacity;
+  *capacity = old_capacity == 0 ? 4 : old_capacity * 2;
+  if (*capacity < needed)
+    *capacity = needed;
+  return rwn_arena_realloc(arena, array, elem_size * (size_t)old_capacity,
+                           elem_size * (size_t)*capacity);
+}
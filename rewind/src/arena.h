@@ -0,0 +1,83 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/allocator.h>
+
+/*
+ * Small allocations are served from size classes of 32, 64, ... bytes carved
+ * out of big blocks; anything larger goes to the allocator directly.
+ */
+#define ARENA_MIN_CLASS_SHIFT 5
+#define ARENA_NUM_CLASSES 8
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock;
+
+struct Arena {
+  RwnAllocator allocator; /* with defaults filled in */
+  void* free_lists[ARENA_NUM_CLASSES];
+  char* bump_ptr;
+  char* bump_end;
+  struct ArenaBlock* blocks;
+};
+
+/**
+ * @brief Initialize the arena on top of the given allocator (or NULL for the
+ * standard library one)
+ */
+extern void rwn_arena_init(struct Arena* arena, const RwnAllocator* allocator);
+
+/**
+ * @brief Free all memory held by the arena in one go, including the small
+ * allocations that were never freed; large ones must be freed by the caller
+ */
+extern void rwn_arena_release(struct Arena* arena);
+
+extern void* rwn_arena_alloc(struct Arena* arena, size_t size);
+
+extern void* rwn_arena_realloc(struct Arena* arena,
+                               void* ptr,
+                               size_t old_size,
+                               size_t new_size);
+
+extern void rwn_arena_free(struct Arena* arena, void* ptr, size_t size);
+
+/**
+ * @brief Make room for at least `needed` elements in a growing array, doubling
+ * its capacity
+ * @return the (possibly moved) array
+ */
+extern void* rwn_arena_reserve(struct Arena* arena,
+                               void* array,
+                               int needed,
+                               int* capacity,
+                               size_t elem_size);
+
+/*
+ * Direct allocator calls, bypassing the size classes
+ */
+extern void* rwn_allocator_alloc(const RwnAllocator* allocator, size_t size);
+
+extern void rwn_allocator_free(const RwnAllocator* allocator,
+                               void* ptr,
+                               size_t size);
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "history_private.h"
+
+void rwn_completion_init(RwnCompletion* completion,
+                         const RwnCompletionSource* source) {
+  completion->pending = 0;
+  completion->source = source;
+  pthread_mutex_init(&completion->mutex, NULL);
+  pthread_cond_init(&completion->done, NULL);
+}
+
+void rwn_completion_apply(RwnCompletion* completion,
+                          RwnEventAsyncApplyFunc func,
+                          const void* evt,
+                          void* state) {
+  // counted first, as the completion may well arrive before func returns
+  __atomic_add_fetch(&completion->pending, 1, __ATOMIC_RELAXED);
+  if (func(evt, state, completion))
+    __atomic_sub_fetch(&completion->pending, 1, __ATOMIC_RELEASE);
+}
+
+void rwn_completion_done(RwnCompletion* completion) {
+  // under the mutex, so the barrier can not free it before we are done
+  pthread_mutex_lock(&completion->mutex);
+  if (__atomic_sub_fetch(&completion->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    pthread_cond_broadcast(&completion->done);
+  pthread_mutex_unlock(&completion->mutex);
+}
+
+void rwn_completion_finish(RwnCompletion* completion) {
+  if (completion->source != NULL) {
+    while (__atomic_load_n(&completion->pending, __ATOMIC_ACQUIRE) > 0)
+      completion->source->wait(completion->source->user_data);
+  }
+
+  pthread_mutex_lock(&completion->mutex);
+  while (__atomic_load_n(&completion->pending, __ATOMIC_ACQUIRE) > 0)
+    pthread_cond_wait(&completion->done, &completion->mutex);
+  pthread_mutex_unlock(&completion->mutex);
+
+  pthread_mutex_destroy(&completion->mutex);
+  pthread_cond_destroy(&completion->done);
+}
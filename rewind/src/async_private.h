@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/async.h>
+
+#include <pthread.h>
+
+/*
+ * Async events of a phase type-tag their entries with this instead of a
+ * registered type
+ */
+#define EVENT_TYPE_ASYNC (-2)
+
+/*
+ * Phase barrier for the async events; lives on the stack of the applying
+ * thread for the duration of the phase
+ */
+struct RwnCompletion {
+  int pending;
+  const RwnCompletionSource* source; /* or NULL to wait on the condition */
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+};
+
+extern void rwn_completion_init(RwnCompletion* completion,
+                                const RwnCompletionSource* source);
+
+/**
+ * @brief Apply the async event with the token, counting it as pending unless
+ * it finished right away; threadsafe
+ */
+extern void rwn_completion_apply(RwnCompletion* completion,
+                                 RwnEventAsyncApplyFunc func,
+                                 const void* evt,
+                                 void* state);
+
+/**
+ * @brief Wait until nothing applied with the token is pending, then free it
+ */
+extern void rwn_completion_finish(RwnCompletion* completion);
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <rewind/checkpoint.h>
+
+#include "history_private.h"
+
+#include <string.h>
+
+void rwn_checkpoints_init(struct CheckpointList* list) {
+  list->enabled = false;
+  memset(&list->funcs, 0, sizeof(list->funcs));
+  list->interval = 1;
+  list->items = NULL;
+  list->count = 0;
+  list->capacity = 0;
+  list->dirty_timepoint = RWN_TIMEPOINT_MAX;
+  list->materialized_timepoint = RWN_TIMEPOINT_MIN;
+}
+
+/*
+ * Position of the latest checkpoint at or before the timepoint
+ */
+static int find_checkpoint(const struct CheckpointList* list,
+                           RwnTimepoint timepoint) {
+  int lo = 0;
+  int hi = list->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (list->items[mid].timepoint <= timepoint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - 1;
+}
+
+static void discard_checkpoints_from(struct CheckpointList* list, int pos) {
+  int i;
+  for (i = pos; i < list->count; ++i)
+    list->funcs.discard(list->items[i].snapshot, list->funcs.user_data);
+  list->count = pos;
+}
+
+static void insert_checkpoint(RwnHistory* h,
+                              int pos,
+                              RwnTimepoint timepoint,
+                              const void* state) {
+  struct CheckpointList* list = &h->checkpoints;
+  list->items = rwn_arena_reserve(&h->arena, list->items, list->count + 1,
+                                  &list->capacity, sizeof(*list->items));
+  memmove(&list->items[pos + 1], &list->items[pos],
+          sizeof(*list->items) * (size_t)(list->count - pos));
+  list->items[pos].timepoint = timepoint;
+  list->items[pos].snapshot = list->funcs.save(state, list->funcs.user_data);
+  list->count += 1;
+}
+
+void rwn_checkpoints_clear(RwnHistory* h) {
+  struct CheckpointList* list = &h->checkpoints;
+  if (list->enabled)
+    discard_checkpoints_from(list, 0);
+  rwn_arena_free(&h->arena, list->items,
+                 sizeof(*list->items) * (size_t)list->capacity);
+  rwn_checkpoints_init(list);
+}
+
+void rwn_checkpoints_mark_dirty(RwnHistory* h, RwnTimepoint timepoint) {
+  struct CheckpointList* list = &h->checkpoints;
+  if (timepoint < list->dirty_timepoint)
+    list->dirty_timepoint = timepoint;
+}
+
+/*
+ * Number of checkpoints that have not seen any modified events
+ */
+static int count_valid_checkpoints(const struct CheckpointList* list) {
+  if (list->dirty_timepoint == RWN_TIMEPOINT_MAX)
+    return list->count;
+  return find_checkpoint(list, list->dirty_timepoint - 1) + 1;
+}
+
+/*
+ * Lazily drop the checkpoints at the dirty timepoint and later; returns
+ * whether the state of the last seek has survived the modifications
+ */
+static bool drop_dirty_checkpoints(struct CheckpointList* list) {
+  bool materialized_valid =
+      list->materialized_timepoint != RWN_TIMEPOINT_MIN &&
+      list->materialized_timepoint < list->dirty_timepoint;
+
+  discard_checkpoints_from(list, count_valid_checkpoints(list));
+  list->dirty_timepoint = RWN_TIMEPOINT_MAX;
+
+  return materialized_valid;
+}
+
+RwnTimepoint rwn_checkpoints_retire(RwnHistory* h, RwnTimepoint watermark) {
+  struct CheckpointList* list = &h->checkpoints;
+  if (!list->enabled)
+    return watermark;
+
+  // the latest checkpoint which has seen all of the retired events
+  int pos = find_checkpoint(list, watermark - 1);
+  int valid = count_valid_checkpoints(list);
+  if (pos >= valid)
+    pos = valid - 1;
+  if (pos < 0)
+    return RWN_TIMEPOINT_MIN;
+  if (list->items[pos].timepoint + 1 < watermark)
+    watermark = list->items[pos].timepoint + 1;
+
+  // nothing can be replayed from the older ones anymore
+  int i;
+  for (i = 0; i < pos; ++i)
+    list->funcs.discard(list->items[i].snapshot, list->funcs.user_data);
+  memmove(&list->items[0], &list->items[pos],
+          sizeof(*list->items) * (size_t)(list->count - pos));
+  list->count -= pos;
+
+  return watermark;
+}
+
+/*
+ * Replay from the state at `current` up to `timepoint`, saving checkpoints at
+ * the ends of blocks; `pos` is the latest checkpoint at or before `current`
+ */
+static int replay(RwnHistory* h,
+                  int pos,
+                  RwnTimepoint current,
+                  RwnTimepoint timepoint,
+                  void* state) {
+  struct CheckpointList* list = &h->checkpoints;
+  int evtcount = 0;
+  int events_since_checkpoint = current == list->items[pos].timepoint ? 0 : 1;
+  while (current < timepoint) {
+    // skip the empty stretch at once
+    RwnTimepoint next = rwn_history_next_timepoint(h, current + 1);
+    if (next < 0 || next > timepoint)
+      break;
+    current = next - 1;
+
+    // replay up to the end of the block of `interval` timepoints or the target
+    RwnTimepoint first = current + 1;
+    RwnTimepoint room = list->interval - 1 - first % list->interval;
+    bool at_block_end = timepoint - first >= room;
+    RwnTimepoint last = at_block_end ? first + room : timepoint;
+    int applied = rwn_history_state_delta_ex(h, first, last, state, NULL);
+    evtcount += applied;
+    events_since_checkpoint += applied;
+    current = last;
+
+    if (at_block_end && events_since_checkpoint > 0) {
+      pos += 1;
+      // an earlier seek might have gone this way already
+      if (pos == list->count || list->items[pos].timepoint != current)
+        insert_checkpoint(h, pos, current, state);
+      events_since_checkpoint = 0;
+    }
+  }
+
+  list->materialized_timepoint = timepoint;
+
+  return evtcount;
+}
+
+void rwn_history_enable_checkpoints(RwnHistory* h,
+                                    const RwnCheckpointFuncs* funcs,
+                                    RwnTimepoint interval,
+                                    const void* initial_state) {
+  rwn_checkpoints_clear(h);
+
+  struct CheckpointList* list = &h->checkpoints;
+  list->enabled = true;
+  list->funcs = *funcs;
+  list->interval = interval < 1 ? 1 : interval;
+  insert_checkpoint(h, 0, -1, initial_state);
+}
+
+void rwn_history_disable_checkpoints(RwnHistory* h) {
+  rwn_checkpoints_clear(h);
+}
+
+int rwn_history_count_checkpoints(const RwnHistory* h) {
+  return count_valid_checkpoints(&h->checkpoints);
+}
+
+RwnTimepoint rwn_history_dirty_timepoint(const RwnHistory* h) {
+  const struct CheckpointList* list = &h->checkpoints;
+  if (!list->enabled || list->dirty_timepoint == RWN_TIMEPOINT_MAX)
+    return -1;
+  return list->dirty_timepoint;
+}
+
+int rwn_history_seek(RwnHistory* h, RwnTimepoint timepoint, void* state) {
+  struct CheckpointList* list = &h->checkpoints;
+  if (!list->enabled || timepoint < 0)
+    return -1;
+
+  rwn_history_flush(h);
+  drop_dirty_checkpoints(list);
+
+  int pos = find_checkpoint(list, timepoint);
+  if (pos < 0)
+    return -1; // retired
+  list->funcs.restore(state, list->items[pos].snapshot, list->funcs.user_data);
+
+  return replay(h, pos, list->items[pos].timepoint, timepoint, state);
+}
+
+int rwn_history_reevaluate(RwnHistory* h, RwnTimepoint timepoint, void* state) {
+  struct CheckpointList* list = &h->checkpoints;
+  if (!list->enabled || timepoint < 0)
+    return -1;
+
+  rwn_history_flush(h);
+  bool materialized_valid = drop_dirty_checkpoints(list);
+
+  // continue with the state at hand, unless a checkpoint is closer
+  int pos = find_checkpoint(list, timepoint);
+  if (pos < 0)
+    return -1; // retired
+  if (materialized_valid && list->materialized_timepoint <= timepoint &&
+      list->items[pos].timepoint <= list->materialized_timepoint)
+    return replay(h, find_checkpoint(list, list->materialized_timepoint),
+                  list->materialized_timepoint, timepoint, state);
+
+  list->funcs.restore(state, list->items[pos].snapshot, list->funcs.user_data);
+
+  return replay(h, pos, list->items[pos].timepoint, timepoint, state);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/checkpoint.h>
+
+#include <stdbool.h>
+
+struct Checkpoint {
+  /* the state after applying all events up to this one */
+  RwnTimepoint timepoint;
+  void* snapshot;
+};
+
+struct CheckpointList {
+  bool enabled;
+  RwnCheckpointFuncs funcs;
+  RwnTimepoint interval;
+  /* sorted by timepoint; the first one is the initial state at -1 */
+  struct Checkpoint* items;
+  int count;
+  int capacity;
+  /* earliest (un)scheduled timepoint since the last seek, or the max one */
+  RwnTimepoint dirty_timepoint;
+  /* timepoint of the last seek result, or RWN_TIMEPOINT_MIN */
+  RwnTimepoint materialized_timepoint;
+};
+
+extern void rwn_checkpoints_init(struct CheckpointList* list);
+
+/**
+ * @brief Discard all checkpoints and free their storage
+ */
+extern void rwn_checkpoints_clear(RwnHistory* h);
+
+/**
+ * @brief Note that events at the given timepoint were modified; the
+ * checkpoints depending on them are dropped on the next seek
+ */
+extern void rwn_checkpoints_mark_dirty(RwnHistory* h, RwnTimepoint timepoint);
+
+/**
+ * @brief Clamp the watermark of retirement to the latest valid checkpoint
+ * which has seen all of the retired events, and discard the checkpoints
+ * before it
+ * @return the watermark that keeps the checkpoints usable
+ */
+extern RwnTimepoint rwn_checkpoints_retire(RwnHistory* h,
+                                           RwnTimepoint watermark);
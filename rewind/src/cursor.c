@@ -0,0 +1,205 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <rewind/cursor.h>
+
+#include "history_private.h"
+
+#include <limits.h>
+
+struct RwnHistoryCursor {
+  const RwnHistory* h;
+  RwnTimepoint timepoint; /* first not fully applied */
+  int phase; /* last applied at `timepoint`, if `started` */
+  bool started; /* some of the phases of `timepoint` were applied */
+  struct IndexPos pos; /* of `timepoint` in the index, as of the last call */
+  bool past_end; /* moved past the last possible timepoint */
+};
+
+/*
+ * O(1) unless the index was edited around the position since the last call
+ */
+static void revalidate(struct RwnHistoryCursor* c, const struct Timeline* tl) {
+  struct IndexPos pos = c->pos;
+  if (rwn_index_pos_valid(tl->index, pos) &&
+      (rwn_index_at_end(tl->index, pos) ||
+       rwn_index_get(tl->index, pos)->timepoint >= c->timepoint)) {
+    if (rwn_index_at_begin(pos))
+      return;
+    rwn_index_prev(tl->index, &pos);
+    if (rwn_index_get(tl->index, pos)->timepoint < c->timepoint)
+      return;
+  }
+  c->pos = rwn_index_lower_bound(tl->index, c->timepoint);
+}
+
+static void move_past(struct RwnHistoryCursor* c, RwnTimepoint timepoint) {
+  if (timepoint == RWN_TIMEPOINT_MAX) {
+    c->timepoint = RWN_TIMEPOINT_MAX;
+    c->past_end = true;
+  } else {
+    c->timepoint = timepoint + 1;
+  }
+  c->started = false;
+}
+
+/*
+ * Replay from the cursor on, at most `max_timepoints` of the populated ones
+ */
+static int walk(struct RwnHistoryCursor* c,
+                RwnTimepoint finish_timepoint,
+                int max_timepoints,
+                void* state,
+                RwnExecutor* executor,
+                const RwnStepFuncs* funcs,
+                bool* stopped) {
+  *stopped = false;
+  if (c->past_end)
+    return 0;
+
+  struct Timeline tl = rwn_history_timeline(c->h);
+  revalidate(c, &tl);
+
+  int evtcount = 0;
+  int visited = 0;
+  while (!rwn_index_at_end(tl.index, c->pos) && visited < max_timepoints) {
+    const struct TimepointHashMapEntry* mapentry =
+        rwn_index_get(tl.index, c->pos);
+    RwnTimepoint timepoint = mapentry->timepoint;
+    if (timepoint > finish_timepoint)
+      break;
+    if (timepoint > c->timepoint) {
+      c->timepoint = timepoint;
+      c->started = false;
+    }
+
+    int p;
+    for (p = 0; p < mapentry->phase_count && !*stopped; ++p) {
+      const struct PhaseBucket* bucket = &mapentry->phases[p];
+      if (c->started && bucket->phase <= c->phase)
+        continue;
+      evtcount +=
+          rwn_timeline_apply_phase(&tl, timepoint, bucket, state, executor);
+      c->phase = bucket->phase;
+      c->started = true;
+      if (funcs != NULL && funcs->after_phase != NULL &&
+          !funcs->after_phase(timepoint, bucket->phase, state,
+                              funcs->user_data))
+        *stopped = true;
+    }
+
+    // unless stopped before its last phase, the timepoint is done; the phases
+    // may have been edited behind the cursor, so compare with the last one
+    if (p == mapentry->phase_count && c->started &&
+        mapentry->phases[p - 1].phase <= c->phase) {
+      move_past(c, timepoint);
+      rwn_index_next(tl.index, &c->pos);
+      visited += 1;
+      if (!*stopped && funcs != NULL && funcs->after_timepoint != NULL &&
+          !funcs->after_timepoint(timepoint, state, funcs->user_data))
+        *stopped = true;
+    }
+    if (*stopped)
+      return evtcount;
+  }
+
+  // all of the range is behind, populated or not
+  if (visited < max_timepoints && finish_timepoint >= c->timepoint)
+    move_past(c, finish_timepoint);
+
+  return evtcount;
+}
+
+int rwn_history_state_delta_until(const RwnHistory* h,
+                                  RwnTimepoint start_timepoint,
+                                  RwnTimepoint finish_timepoint,
+                                  void* state,
+                                  RwnExecutor* executor,
+                                  const RwnStepFuncs* step_funcs,
+                                  RwnTimepoint* stopped_timepoint) {
+  if (stopped_timepoint != NULL)
+    *stopped_timepoint = -1;
+  if (start_timepoint < 0 || finish_timepoint < start_timepoint)
+    return 0;
+
+  struct RwnHistoryCursor c;
+  c.h = h;
+  c.timepoint = start_timepoint;
+  c.started = false;
+  c.pos = rwn_timepoints_lower_bound(h, start_timepoint);
+  c.past_end = false;
+
+  bool stopped;
+  int evtcount = walk(&c, finish_timepoint, INT_MAX, state, executor,
+                      step_funcs, &stopped);
+  if (stopped && stopped_timepoint != NULL)
+    *stopped_timepoint =
+        !c.started && !c.past_end ? c.timepoint - 1 : c.timepoint;
+
+  return evtcount;
+}
+
+RwnHistoryCursor* rwn_history_cursor_create(const RwnHistory* h,
+                                            RwnTimepoint timepoint) {
+  RwnHistoryCursor* c = rwn_allocator_alloc(&h->arena.allocator, sizeof(*c));
+  c->h = h;
+  rwn_history_cursor_reset(c, timepoint);
+  return c;
+}
+
+void rwn_history_cursor_destroy(RwnHistoryCursor* c) {
+  rwn_allocator_free(&c->h->arena.allocator, c, sizeof(*c));
+}
+
+void rwn_history_cursor_reset(RwnHistoryCursor* c, RwnTimepoint timepoint) {
+  c->timepoint = timepoint < 0 ? 0 : timepoint;
+  c->started = false;
+  c->pos = rwn_timepoints_lower_bound(c->h, c->timepoint);
+  c->past_end = false;
+}
+
+RwnTimepoint rwn_history_cursor_timepoint(const RwnHistoryCursor* c) {
+  return c->timepoint;
+}
+
+int rwn_history_cursor_step(RwnHistoryCursor* c,
+                            void* state,
+                            RwnExecutor* executor) {
+  if (c->past_end)
+    return -1;
+  struct Timeline tl = rwn_history_timeline(c->h);
+  revalidate(c, &tl);
+  if (rwn_index_at_end(tl.index, c->pos))
+    return -1;
+
+  bool stopped;
+  return walk(c, RWN_TIMEPOINT_MAX, 1, state, executor, NULL, &stopped);
+}
+
+int rwn_history_cursor_run(RwnHistoryCursor* c,
+                           RwnTimepoint finish_timepoint,
+                           void* state,
+                           RwnExecutor* executor,
+                           const RwnStepFuncs* step_funcs) {
+  bool stopped;
+  return walk(c, finish_timepoint, INT_MAX, state, executor, step_funcs,
+              &stopped);
+}
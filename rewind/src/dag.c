@@ -0,0 +1,232 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <rewind/dag.h>
+
+#include "history_private.h"
+
+#include <string.h>
+
+/*
+ * Event of the graph; its level is one more than the highest level of the
+ * earlier events it conflicts with, so all events of a level are independent
+ */
+struct DagNode {
+  const void* evt;
+  RwnEventApplyFunc evt_apply_func;
+  uint64_t conflict_key;
+  int level;
+};
+
+struct DagBuilder {
+  struct DagNode* nodes;
+  int node_count;
+
+  /* open addressing, highest level of every non-zero key seen so far */
+  uint64_t* keys;
+  int* key_levels;
+  uint64_t key_mask;
+
+  int barrier_level; /* highest level of the key-zero events */
+  int max_level;
+
+  /* the (timepoint, phase) being visited; its events do not conflict */
+  RwnTimepoint group_timepoint;
+  int group_phase;
+  int group_begin;
+};
+
+static uint64_t hash_key(uint64_t key) {
+  // Fibonacci hashing, the top bits are the best mixed
+  return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+static int* find_key_level(struct DagBuilder* b, uint64_t key) {
+  uint64_t i = hash_key(key) & b->key_mask;
+  while (b->keys[i] != 0 && b->keys[i] != key)
+    i = (i + 1) & b->key_mask;
+  if (b->keys[i] == 0) {
+    b->keys[i] = key;
+    b->key_levels[i] = 0;
+  }
+  return &b->key_levels[i];
+}
+
+/*
+ * Make the finished group visible to the events of the next groups
+ */
+static void commit_group(struct DagBuilder* b) {
+  int i;
+  for (i = b->group_begin; i < b->node_count; ++i) {
+    const struct DagNode* node = &b->nodes[i];
+    if (node->conflict_key == 0) {
+      if (node->level > b->barrier_level)
+        b->barrier_level = node->level;
+    } else {
+      int* level = find_key_level(b, node->conflict_key);
+      if (node->level > *level)
+        *level = node->level;
+    }
+    if (node->level > b->max_level)
+      b->max_level = node->level;
+  }
+  b->group_begin = b->node_count;
+}
+
+static bool add_node(const RwnEventInfo* info, void* user_data) {
+  struct DagBuilder* b = user_data;
+  if (info->evt == NULL || info->evt_apply_func == NULL)
+    return true;
+
+  if (info->timepoint != b->group_timepoint ||
+      info->phase != b->group_phase) {
+    commit_group(b);
+    b->group_timepoint = info->timepoint;
+    b->group_phase = info->phase;
+  }
+
+  struct DagNode* node = &b->nodes[b->node_count];
+  node->evt = info->evt;
+  node->evt_apply_func = info->evt_apply_func;
+  node->conflict_key = info->conflict_key;
+  if (info->conflict_key == 0) {
+    node->level = b->max_level + 1;
+  } else {
+    int after = *find_key_level(b, info->conflict_key);
+    if (b->barrier_level > after)
+      after = b->barrier_level;
+    node->level = after + 1;
+  }
+  b->node_count += 1;
+
+  return true;
+}
+
+static bool count_node(const RwnEventInfo* info, void* user_data) {
+  int* count = user_data;
+  // async events need the phase barriers, see below
+  if (info->evt_async_apply_func != NULL) {
+    *count = -1;
+    return false;
+  }
+  if (info->evt != NULL && info->evt_apply_func != NULL)
+    *count += 1;
+  return true;
+}
+
+struct DagLevelBatch {
+  const struct DagNode* nodes;
+  const int* order; /* node indices of the level */
+  void* state;
+};
+
+static void apply_level_task(void* ctx, int task, int worker) {
+  (void)worker;
+  struct DagLevelBatch* batch = ctx;
+  const struct DagNode* node = &batch->nodes[batch->order[task]];
+  node->evt_apply_func(node->evt, batch->state);
+}
+
+int rwn_history_state_delta_dag(const RwnHistory* h,
+                                RwnTimepoint start_timepoint,
+                                RwnTimepoint finish_timepoint,
+                                void* state,
+                                RwnExecutor* executor) {
+  if (executor == NULL || finish_timepoint < start_timepoint)
+    return rwn_history_state_delta_ex(h, start_timepoint, finish_timepoint,
+                                      state, executor);
+
+  int count = 0;
+  rwn_history_visit_events(h, start_timepoint, finish_timepoint, count_node,
+                           &count);
+  if (count == 0)
+    return 0;
+  if (count < 0)
+    return rwn_history_state_delta_ex(h, start_timepoint, finish_timepoint,
+                                      state, executor);
+
+  const RwnAllocator* allocator = &h->arena.allocator;
+  int key_capacity = 1;
+  while (key_capacity < count * 2)
+    key_capacity *= 2;
+
+  struct DagBuilder b;
+  b.nodes = rwn_allocator_alloc(allocator, sizeof(*b.nodes) * (size_t)count);
+  b.node_count = 0;
+  b.keys = rwn_allocator_alloc(allocator,
+                               sizeof(*b.keys) * (size_t)key_capacity);
+  memset(b.keys, 0, sizeof(*b.keys) * (size_t)key_capacity);
+  b.key_levels = rwn_allocator_alloc(
+      allocator, sizeof(*b.key_levels) * (size_t)key_capacity);
+  b.key_mask = (uint64_t)key_capacity - 1;
+  b.barrier_level = 0;
+  b.max_level = 0;
+  b.group_timepoint = -1;
+  b.group_phase = 0;
+  b.group_begin = 0;
+  rwn_history_visit_events(h, start_timepoint, finish_timepoint, add_node,
+                           &b);
+  commit_group(&b);
+
+  /*
+   * Counting sort of the nodes by level, keeping the sequential order within
+   * a level
+   */
+  int level_count = b.max_level + 1;
+  int* level_begin = rwn_allocator_alloc(
+      allocator, sizeof(*level_begin) * (size_t)(level_count + 1));
+  memset(level_begin, 0, sizeof(*level_begin) * (size_t)(level_count + 1));
+  int i;
+  for (i = 0; i < b.node_count; ++i)
+    level_begin[b.nodes[i].level + 1] += 1;
+  for (i = 1; i <= level_count; ++i)
+    level_begin[i] += level_begin[i - 1];
+
+  int* order = rwn_allocator_alloc(allocator, sizeof(*order) * (size_t)count);
+  int* fill = rwn_allocator_alloc(allocator,
+                                  sizeof(*fill) * (size_t)level_count);
+  memcpy(fill, level_begin, sizeof(*fill) * (size_t)level_count);
+  for (i = 0; i < b.node_count; ++i)
+    order[fill[b.nodes[i].level]++] = i;
+  rwn_allocator_free(allocator, fill, sizeof(*fill) * (size_t)level_count);
+
+  struct DagLevelBatch batch;
+  batch.nodes = b.nodes;
+  batch.state = state;
+  int level;
+  for (level = 1; level < level_count; ++level) {
+    batch.order = &order[level_begin[level]];
+    rwn_executor_run_batch(executor,
+                           level_begin[level + 1] - level_begin[level],
+                           apply_level_task, &batch);
+  }
+
+  rwn_allocator_free(allocator, order, sizeof(*order) * (size_t)count);
+  rwn_allocator_free(allocator, level_begin,
+                     sizeof(*level_begin) * (size_t)(level_count + 1));
+  rwn_allocator_free(allocator, b.key_levels,
+                     sizeof(*b.key_levels) * (size_t)key_capacity);
+  rwn_allocator_free(allocator, b.keys,
+                     sizeof(*b.keys) * (size_t)key_capacity);
+  rwn_allocator_free(allocator, b.nodes, sizeof(*b.nodes) * (size_t)count);
+
+  return count;
+}
@@ -0,0 +1,385 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE /* thread affinity */
+
+#include "executor_private.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#define EXECUTOR_HAS_AFFINITY
+#endif
+
+/*
+ * Per-worker deque of task indices. Since the whole batch is known upfront,
+ * a deque is just a contiguous range `[begin, end)` packed into one word: the
+ * owner pops tasks from the front, thieves steal halves from the back, both
+ * with a single CAS.
+ */
+struct WorkerDeque {
+  uint64_t range;
+  char pad[EXECUTOR_CACHE_LINE - sizeof(uint64_t)];
+};
+
+struct Worker {
+  RwnExecutor* ex;
+  int index;
+  int cpu; /* pinned to, or -1 */
+  pthread_t thread;
+};
+
+struct RwnExecutor {
+  int num_threads;
+  struct Worker* workers; /* index 0 is the submitting thread */
+  struct WorkerDeque* deques;
+
+  pthread_mutex_t submit_mutex; /* serializes batches */
+  pthread_mutex_t mutex;
+  pthread_cond_t batch_cond; /* signalled when a new batch was posted */
+  pthread_cond_t done_cond;  /* signalled when the last worker is done */
+  unsigned long batch_seqno;
+  bool shutdown;
+  bool deterministic; /* no stealing */
+
+  /* current batch */
+  ExecutorTaskFunc func;
+  void* ctx;
+  int busy_workers;
+};
+
+static uint64_t pack_range(uint32_t begin, uint32_t end) {
+  return ((uint64_t)end << 32) | begin;
+}
+
+static bool pop_task(struct WorkerDeque* d, int* task) {
+  uint64_t range = __atomic_load_n(&d->range, __ATOMIC_ACQUIRE);
+  for (;;) {
+    uint32_t begin = (uint32_t)range;
+    uint32_t end = (uint32_t)(range >> 32);
+    if (begin >= end)
+      return false;
+    if (__atomic_compare_exchange_n(&d->range, &range,
+                                    pack_range(begin + 1, end), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *task = (int)begin;
+      return true;
+    }
+  }
+}
+
+static bool steal_tasks(struct WorkerDeque* victim,
+                        uint32_t* stolen_begin,
+                        uint32_t* stolen_end) {
+  uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+  for (;;) {
+    uint32_t begin = (uint32_t)range;
+    uint32_t end = (uint32_t)(range >> 32);
+    if (begin >= end)
+      return false;
+    // take the back half, rounding up so that a single task can be stolen
+    uint32_t split = end - (end - begin + 1) / 2;
+    if (__atomic_compare_exchange_n(&victim->range, &range,
+                                    pack_range(begin, split), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *stolen_begin = split;
+      *stolen_end = end;
+      return true;
+    }
+  }
+}
+
+/*
+ * Refill own (empty) deque from the first non-empty victim
+ */
+static bool steal_into(RwnExecutor* ex, int self) {
+  int i;
+  for (i = 1; i < ex->num_threads; ++i) {
+    uint32_t begin, end;
+    struct WorkerDeque* victim = &ex->deques[(self + i) % ex->num_threads];
+    if (steal_tasks(victim, &begin, &end)) {
+      __atomic_store_n(&ex->deques[self].range, pack_range(begin, end),
+                       __ATOMIC_RELEASE);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void run_tasks(RwnExecutor* ex, int self) {
+  int task;
+  do {
+    while (pop_task(&ex->deques[self], &task))
+      ex->func(ex->ctx, task, self);
+  } while (!ex->deterministic && steal_into(ex, self));
+}
+
+static void* worker_main(void* arg) {
+  struct Worker* worker = arg;
+  RwnExecutor* ex = worker->ex;
+  unsigned long seen_seqno = 0;
+
+  pthread_mutex_lock(&ex->mutex);
+  for (;;) {
+    while (!ex->shutdown && ex->batch_seqno == seen_seqno)
+      pthread_cond_wait(&ex->batch_cond, &ex->mutex);
+    if (ex->shutdown)
+      break;
+    seen_seqno = ex->batch_seqno;
+    pthread_mutex_unlock(&ex->mutex);
+
+    run_tasks(ex, worker->index);
+
+    pthread_mutex_lock(&ex->mutex);
+    ex->busy_workers -= 1;
+    if (ex->busy_workers == 0)
+      pthread_cond_signal(&ex->done_cond);
+  }
+  pthread_mutex_unlock(&ex->mutex);
+
+  return NULL;
+}
+
+void* rwn_cache_line_alloc(size_t size) {
+  void* ptr;
+  if (posix_memalign(&ptr, EXECUTOR_CACHE_LINE, size) != 0)
+    return NULL;
+  return ptr;
+}
+
+/*
+ * Start the worker on its CPU right away, so that its stack and everything it
+ * touches first are allocated on the CPU's node
+ */
+static void spawn_worker(struct Worker* worker) {
+#ifdef EXECUTOR_HAS_AFFINITY
+  if (worker->cpu >= 0) {
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker->cpu, &cpuset);
+    pthread_attr_init(&attr);
+    int rc = pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+    if (rc == 0)
+      rc = pthread_create(&worker->thread, &attr, worker_main, worker);
+    pthread_attr_destroy(&attr);
+    if (rc == 0)
+      return;
+    // e.g. the CPU is offline or not allowed for the process
+    worker->cpu = -1;
+  }
+#endif
+  pthread_create(&worker->thread, NULL, worker_main, worker);
+}
+
+static RwnExecutor* create_executor(int num_threads,
+                                    const int* cpus,
+                                    int cpu_count) {
+  if (num_threads < 1)
+    return NULL;
+
+  RwnExecutor* ex = malloc(sizeof(*ex));
+  ex->num_threads = num_threads;
+  ex->workers = malloc(sizeof(*ex->workers) * num_threads);
+  ex->deques = rwn_cache_line_alloc(sizeof(*ex->deques) * num_threads);
+  pthread_mutex_init(&ex->submit_mutex, NULL);
+  pthread_mutex_init(&ex->mutex, NULL);
+  pthread_cond_init(&ex->batch_cond, NULL);
+  pthread_cond_init(&ex->done_cond, NULL);
+  ex->batch_seqno = 0;
+  ex->shutdown = false;
+  ex->deterministic = false;
+  ex->func = NULL;
+  ex->ctx = NULL;
+  ex->busy_workers = 0;
+
+  int i;
+  for (i = 0; i < num_threads; ++i) {
+    ex->workers[i].ex = ex;
+    ex->workers[i].index = i;
+    // the submitting thread is left alone
+    ex->workers[i].cpu =
+        i > 0 && cpu_count > 0 ? cpus[(i - 1) % cpu_count] : -1;
+    ex->deques[i].range = pack_range(0, 0);
+    if (i > 0)
+      spawn_worker(&ex->workers[i]);
+  }
+
+  return ex;
+}
+
+RwnExecutor* rwn_executor_create(int num_threads) {
+  return create_executor(num_threads, NULL, 0);
+}
+
+RwnExecutor* rwn_executor_create_pinned(int num_threads,
+                                        const int* cpus,
+                                        int cpu_count) {
+#ifdef EXECUTOR_HAS_AFFINITY
+  if (cpu_count < 1)
+    return NULL;
+  int i;
+  for (i = 0; i < cpu_count; ++i)
+    if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE)
+      return NULL;
+  return create_executor(num_threads, cpus, cpu_count);
+#else
+  (void)num_threads;
+  (void)cpus;
+  (void)cpu_count;
+  return NULL;
+#endif
+}
+
+/*
+ * Parse a kernel CPU list such as "0-3,8-11"
+ */
+static int parse_cpu_list(FILE* f, int* cpus, int max_cpus) {
+  int count = 0;
+  int first, last;
+  while (fscanf(f, "%d", &first) == 1) {
+    last = first;
+    int c = fgetc(f);
+    if (c == '-') {
+      if (fscanf(f, "%d", &last) != 1)
+        break;
+      c = fgetc(f);
+    }
+    int cpu;
+    for (cpu = first; cpu <= last && count < max_cpus; ++cpu)
+      cpus[count++] = cpu;
+    if (c != ',')
+      break;
+  }
+  return count;
+}
+
+RwnExecutor* rwn_executor_create_on_node(int num_threads, int node) {
+#ifdef EXECUTOR_HAS_AFFINITY
+  if (node < 0)
+    return NULL;
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+  FILE* f = fopen(path, "r");
+  if (f == NULL)
+    return NULL;
+  int* cpus = malloc(sizeof(*cpus) * CPU_SETSIZE);
+  int cpu_count = parse_cpu_list(f, cpus, CPU_SETSIZE);
+  fclose(f);
+
+  RwnExecutor* ex = rwn_executor_create_pinned(num_threads, cpus, cpu_count);
+  free(cpus);
+  return ex;
+#else
+  (void)num_threads;
+  (void)node;
+  return NULL;
+#endif
+}
+
+void rwn_executor_destroy(RwnExecutor* ex) {
+  pthread_mutex_lock(&ex->mutex);
+  ex->shutdown = true;
+  pthread_cond_broadcast(&ex->batch_cond);
+  pthread_mutex_unlock(&ex->mutex);
+
+  int i;
+  for (i = 1; i < ex->num_threads; ++i)
+    pthread_join(ex->workers[i].thread, NULL);
+
+  pthread_cond_destroy(&ex->done_cond);
+  pthread_cond_destroy(&ex->batch_cond);
+  pthread_mutex_destroy(&ex->mutex);
+  pthread_mutex_destroy(&ex->submit_mutex);
+  free(ex->deques);
+  free(ex->workers);
+  free(ex);
+}
+
+int rwn_executor_num_threads(const RwnExecutor* ex) {
+  return ex->num_threads;
+}
+
+void rwn_executor_set_deterministic(RwnExecutor* ex, bool deterministic) {
+  ex->deterministic = deterministic;
+}
+
+int rwn_executor_worker_cpu(const RwnExecutor* ex, int worker) {
+  if (worker < 0 || worker >= ex->num_threads)
+    return -1;
+  return ex->workers[worker].cpu;
+}
+
+void rwn_executor_run_batch(RwnExecutor* ex,
+                            int num_tasks,
+                            ExecutorTaskFunc func,
+                            void* ctx) {
+  if (num_tasks <= 0)
+    return;
+
+  /*
+   * Not worth waking anybody up
+   */
+  if (ex->num_threads == 1 || num_tasks == 1) {
+    int i;
+    for (i = 0; i < num_tasks; ++i)
+      func(ctx, i, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&ex->submit_mutex);
+
+  /*
+   * Deal contiguous chunks of the batch to the workers; from now on only a
+   * single barrier at the end of the batch, the rest is balanced by stealing
+   */
+  int i;
+  for (i = 0; i < ex->num_threads; ++i) {
+    uint32_t begin = (uint32_t)((int64_t)num_tasks * i / ex->num_threads);
+    uint32_t end = (uint32_t)((int64_t)num_tasks * (i + 1) / ex->num_threads);
+    ex->deques[i].range = pack_range(begin, end);
+  }
+
+  pthread_mutex_lock(&ex->mutex);
+  ex->func = func;
+  ex->ctx = ctx;
+  ex->busy_workers = ex->num_threads - 1;
+  ex->batch_seqno += 1;
+  pthread_cond_broadcast(&ex->batch_cond);
+  pthread_mutex_unlock(&ex->mutex);
+
+  // the submitter is a worker too
+  run_tasks(ex, 0);
+
+  pthread_mutex_lock(&ex->mutex);
+  while (ex->busy_workers > 0)
+    pthread_cond_wait(&ex->done_cond, &ex->mutex);
+  pthread_mutex_unlock(&ex->mutex);
+
+  pthread_mutex_unlock(&ex->submit_mutex);
+}
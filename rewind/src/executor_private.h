@@ -0,0 +1,55 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/executor.h>
+
+#include <stddef.h>
+
+#define EXECUTOR_CACHE_LINE 64
+
+/**
+ * @brief Allocate memory starting at a cache line, so that the elements padded
+ * to `EXECUTOR_CACHE_LINE` never share one; free with `free()`
+ */
+extern void* rwn_cache_line_alloc(size_t size);
+
+/**
+ * @brief Task of a batch; called once for every index in `[0, num_tasks)`.
+ * `worker` is the index of the thread running the task, in
+ * `[0, rwn_executor_num_threads())`, zero being the submitting thread
+ */
+typedef void (*ExecutorTaskFunc)(void* ctx, int task, int worker);
+
+/**
+ * @brief Run a batch of tasks on the executor's workers (and the calling
+ * thread) and return after all of them are finished. Only one batch at a time
+ * is executed; concurrent submitters are serialized.
+ * @param ex
+ * @param num_tasks
+ * @param func
+ * @param ctx
+ */
+extern void rwn_executor_run_batch(RwnExecutor* ex,
+                                   int num_tasks,
+                                   ExecutorTaskFunc func,
+                                   void* ctx);
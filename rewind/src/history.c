@@ -21,345 +21,1811 @@
  */
 #include <rewind/history.h>
 
-#include "uthash.h"
-#include "utlist.h"
-
-#include <pthread.h>
+#include "history_private.h"
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct EventListEntry {
-  void* user_event;
-  RwnEventApplyFunc user_event_apply_func;
-  RwnEventDestroyFunc user_event_destroy_func;
-  int phase;
-  struct EventListEntry* next;
-};
+static void* reserve_capacity(RwnHistory* h,
+                              void* array,
+                              int needed,
+                              int* capacity,
+                              size_t elem_size) {
+  return rwn_arena_reserve(&h->arena, array, needed, capacity, elem_size);
+}
 
-struct TimepointHashMapEntry {
-  int timepoint; /* key */
-  struct EventListEntry* event_list;
-  UT_hash_handle hh;
-};
+static void* reserve_one_more(RwnHistory* h,
+                              void* array,
+                              int count,
+                              int* capacity,
+                              size_t elem_size) {
+  return reserve_capacity(h, array, count + 1, capacity, elem_size);
+}
 
-struct RwnEventHandle {
-  int timepoint;
-  struct EventListEntry* event_list_elem;
-  RwnEventHandle* next;
-};
+/*
+ * Binary search for the bucket of the phase; returns its index or, if there is
+ * no such bucket, the index where it should be inserted (and sets `found`)
+ */
+static int find_phase_bucket(const struct TimepointHashMapEntry* mapentry,
+                             int phase,
+                             bool* found) {
+  int lo = 0;
+  int hi = mapentry->phase_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (mapentry->phases[mid].phase < phase)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
 
-struct RwnHistory {
-  struct TimepointHashMapEntry* timepoint_hash_map;
-  RwnEventHandle* event_handle_list;
-};
+  *found = lo < mapentry->phase_count && mapentry->phases[lo].phase == phase;
+  return lo;
+}
+
+static RwnEventHandle* encode_handle(const RwnHistory* h, int slot) {
+  if (slot == NO_HANDLE_SLOT)
+    return NULL;
+  assert(slot < HANDLE_SLOT_LIMIT);
+  return (RwnEventHandle*)((h->slots[slot].generation << HANDLE_SLOT_BITS) |
+                           (uintptr_t)(slot + 1));
+}
+
+/*
+ * Returns the slot of a live handle or -1 if the handle is stale or bogus
+ */
+static int decode_handle(const RwnHistory* h, const RwnEventHandle* eh) {
+  uintptr_t bits = (uintptr_t)eh;
+  uintptr_t slot = (bits & HANDLE_SLOT_MASK);
+  if (slot == 0 || slot > (uintptr_t)h->slot_count)
+    return -1;
+  slot -= 1;
+
+  const struct HandleSlot* hs = &h->slots[slot];
+  if (hs->mapentry == NULL || hs->generation != (bits >> HANDLE_SLOT_BITS))
+    return -1;
+
+  return (int)slot;
+}
+
+static bool has_free_handle_slots(const RwnHistory* h, int count) {
+  return count <= HANDLE_SLOT_LIMIT - h->live_slot_count;
+}
+
+static int alloc_handle_slot(RwnHistory* h) {
+  assert(has_free_handle_slots(h, 1));
+  int slot;
+  if (h->free_slot >= 0) {
+    slot = h->free_slot;
+    h->free_slot = h->slots[slot].next_free;
+  } else {
+    h->slots = reserve_one_more(h, h->slots, h->slot_count, &h->slot_capacity,
+                                sizeof(*h->slots));
+    slot = h->slot_count;
+    h->slot_count += 1;
+    h->slots[slot].generation = 1;
+  }
+  h->slots[slot].next_free = -1;
+  h->live_slot_count += 1;
+
+  return slot;
+}
+
+static void free_handle_slot(RwnHistory* h, int slot) {
+  struct HandleSlot* hs = &h->slots[slot];
+  hs->mapentry = NULL;
+  hs->generation = (hs->generation + 1) & HANDLE_GENERATION_MASK;
+  if (hs->generation == 0)
+    hs->generation = 1;
+  hs->next_free = h->free_slot;
+  h->free_slot = slot;
+  h->live_slot_count -= 1;
+}
+
+struct IndexPos rwn_timepoints_lower_bound(const RwnHistory* h,
+                                           RwnTimepoint timepoint) {
+  return rwn_index_lower_bound(&h->timepoint_index, timepoint);
+}
+
+static void unindex_timepoint(RwnHistory* h,
+                              const struct TimepointHashMapEntry* mapentry) {
+  struct IndexPos first = rwn_timepoints_lower_bound(h, mapentry->timepoint);
+  assert(!rwn_index_at_end(&h->timepoint_index, first) &&
+         rwn_index_get(&h->timepoint_index, first) == mapentry);
+
+  struct IndexPos last = first;
+  rwn_index_next(&h->timepoint_index, &last);
+  rwn_index_remove_range(&h->timepoint_index, first, last);
+}
 
 RwnHistory* rwn_history_create(void) {
-  RwnHistory* h;
+  return rwn_history_create_ex(NULL);
+}
 
-  h = malloc(sizeof(*h));
+RwnHistory* rwn_history_create_ex(const RwnAllocator* allocator) {
+  struct Arena arena;
+  rwn_arena_init(&arena, allocator);
+
+  RwnHistory* h = rwn_allocator_alloc(&arena.allocator, sizeof(*h));
+  if (h == NULL)
+    return NULL;
+
+  h->arena = arena;
 
   h->timepoint_hash_map = NULL;
-  h->event_handle_list = NULL;
+  rwn_index_init(&h->timepoint_index, &h->arena.allocator);
+  h->slots = NULL;
+  h->slot_count = 0;
+  h->slot_capacity = 0;
+  h->free_slot = -1;
+  h->live_slot_count = 0;
+  rwn_checkpoints_init(&h->checkpoints);
+  rwn_mapping_init(&h->mapping);
+  h->pending = NULL;
+  h->types = NULL;
+  h->type_count = 0;
+  h->type_capacity = 0;
+  h->completion_source.wait = NULL;
+  h->completion_source.user_data = NULL;
+  h->trace = NULL;
+  h->watermark = 0;
+  h->window = 0;
+  h->retire_func = NULL;
+  h->retire_user_data = NULL;
+#ifdef RWN_STATS
+  h->stats = rwn_stats_create(&h->arena.allocator);
+#endif
 
   return h;
 }
 
-void rwn_history_destroy(RwnHistory* h) {
-  // free the tp map
-  struct TimepointHashMapEntry *entry, *entry_tmp;
-  HASH_ITER(hh, h->timepoint_hash_map, entry, entry_tmp) {
-    // free events of the tp map entry
-    struct EventListEntry *evtentry, *evtentry_tmp;
-    LL_FOREACH_SAFE(entry->event_list, evtentry, evtentry_tmp) {
-      LL_DELETE(entry->event_list, evtentry);
+/*
+ * Destroy all events of the timepoint, invalidate their handles and free the
+ * phase buckets; the entry itself is left for the caller to unlink and free
+ */
+static int free_timepoint_events(RwnHistory* h,
+                                 struct TimepointHashMapEntry* mapentry) {
+  rwn_version_thaw(mapentry);
+
+  int evtcount = 0;
+  int i, j;
+  for (i = 0; i < mapentry->phase_count; ++i) {
+    struct PhaseBucket* bucket = &mapentry->phases[i];
+    for (j = 0; j < bucket->event_count; ++j) {
       // free the user structure if needed
+      struct EventEntry* evtentry = &bucket->events[j];
       if (evtentry->user_event_destroy_func != NULL)
         evtentry->user_event_destroy_func(evtentry->user_event);
-      free(evtentry);
+      if (evtentry->slot != NO_HANDLE_SLOT)
+        free_handle_slot(h, evtentry->slot);
     }
-    HASH_DEL(h->timepoint_hash_map, entry);
-    free(entry);
+    evtcount += bucket->event_count;
+    rwn_arena_free(&h->arena, bucket->events,
+                   sizeof(*bucket->events) * (size_t)bucket->event_capacity);
+    rwn_arena_free(&h->arena, bucket->payloads,
+                   (size_t)bucket->payload_capacity);
   }
+  rwn_arena_free(&h->arena, mapentry->phases,
+                 sizeof(*mapentry->phases) * (size_t)mapentry->phase_capacity);
+  mapentry->phases = NULL;
+  mapentry->phase_count = 0;
+  mapentry->phase_capacity = 0;
+  mapentry->event_count = 0;
+  mapentry->irreversible_count = 0;
+
+  return evtcount;
+}
+
+void rwn_history_destroy(RwnHistory* h) {
+  // whatever is still staged gets destroyed along with the rest
+  rwn_history_flush(h);
+  rwn_checkpoints_clear(h);
+#ifdef RWN_STATS
+  rwn_stats_destroy(h->stats);
+#endif
 
-  // free/invalidate all issued event handles
-  RwnEventHandle *handle, *handle_tmp;
-  LL_FOREACH_SAFE(h->event_handle_list, handle, handle_tmp) {
-    LL_DELETE(h->event_handle_list, handle);
-    free(handle);
+  // free the tp map
+  struct TimepointHashMapEntry *entry, *entry_tmp;
+  HASH_ITER(hh, h->timepoint_hash_map, entry, entry_tmp) {
+    free_timepoint_events(h, entry);
+    HASH_DEL(h->timepoint_hash_map, entry);
   }
 
+  rwn_index_release(&h->timepoint_index);
+  rwn_arena_free(&h->arena, h->types,
+                 sizeof(*h->types) * (size_t)h->type_capacity);
+
+  // invalidate all issued event handles
+  rwn_arena_free(&h->arena, h->slots,
+                 sizeof(*h->slots) * (size_t)h->slot_capacity);
+
+  // only now nothing points into the loaded file anymore
+  rwn_mapping_release(&h->mapping);
+
+  // the rest (map entries, small buckets) goes away with the arena blocks
+  struct Arena arena = h->arena;
+  rwn_arena_release(&arena);
+
   // free the main struct
-  free(h);
+  rwn_allocator_free(&arena.allocator, h, sizeof(*h));
 }
 
-static int cmp_event_list_entries_by_phase(const struct EventListEntry* lhs,
-                                           const struct EventListEntry* rhs) {
-  if (lhs->phase < rhs->phase)
-    return -1;
-  if (lhs->phase > rhs->phase)
-    return 1;
+static bool is_event_applicable(const struct EventEntry* evtentry) {
+  return evtentry->user_event != NULL &&
+         (evtentry->user_event_apply_func != NULL ||
+          evtentry->user_event_async_apply_func != NULL);
+}
 
-  return 0;
+static bool is_event_irreversible(const struct EventEntry* evtentry) {
+  return is_event_applicable(evtentry) &&
+         evtentry->user_event_revert_func == NULL;
+}
+
+/*
+ * New map entry, not yet in the ordered index
+ */
+static struct TimepointHashMapEntry* add_timepoint(RwnHistory* h,
+                                                   RwnTimepoint timepoint) {
+  struct TimepointHashMapEntry* mapentry =
+      rwn_arena_alloc(&h->arena, sizeof(*mapentry));
+  mapentry->timepoint = timepoint;
+  mapentry->event_count = 0;
+  mapentry->irreversible_count = 0;
+  mapentry->phase_count = 0;
+  mapentry->phase_capacity = 0;
+  mapentry->phases = NULL;
+  mapentry->frozen = NULL;
+  HASH_ADD_TIMEPOINT(h->timepoint_hash_map, timepoint, mapentry);
+
+  return mapentry;
+}
+
+/*
+ * Find or insert the phase bucket, keeping the buckets sorted by phase
+ */
+static struct PhaseBucket* get_phase_bucket(
+    RwnHistory* h,
+    struct TimepointHashMapEntry* mapentry,
+    int phase) {
+  bool found;
+  int phase_index = find_phase_bucket(mapentry, phase, &found);
+  if (!found) {
+    mapentry->phases =
+        reserve_one_more(h, mapentry->phases, mapentry->phase_count,
+                         &mapentry->phase_capacity, sizeof(*mapentry->phases));
+    memmove(&mapentry->phases[phase_index + 1], &mapentry->phases[phase_index],
+            sizeof(*mapentry->phases) *
+                (size_t)(mapentry->phase_count - phase_index));
+    mapentry->phase_count += 1;
+
+    struct PhaseBucket* bucket = &mapentry->phases[phase_index];
+    bucket->phase = phase;
+    bucket->event_count = 0;
+    bucket->event_capacity = 0;
+    bucket->events = NULL;
+    bucket->payloads = NULL;
+    bucket->payload_bytes = 0;
+    bucket->payload_capacity = 0;
+    bucket->payload_garbage = 0;
+    bucket->async_count = 0;
+  }
+
+  return &mapentry->phases[phase_index];
+}
+
+/*
+ * Payloads are aligned as their size allows: the alignment of a type always
+ * divides its size, so a run of payloads of one type stays an array
+ */
+static int payload_offset(int offset, size_t size) {
+  int align = 1;
+  while (align < 16 && size % (size_t)(align * 2) == 0)
+    align *= 2;
+  return (offset + align - 1) & ~(align - 1);
+}
+
+/*
+ * Move the payloads of the bucket's typed events into a new buffer of the
+ * given capacity, in the order of the events, dropping the removed ones
+ */
+static void repack_payloads(RwnHistory* h,
+                            struct PhaseBucket* bucket,
+                            int capacity) {
+  char* payloads = rwn_arena_alloc(&h->arena, (size_t)capacity);
+  int bytes = 0;
+  int j;
+  for (j = 0; j < bucket->event_count; ++j) {
+    struct EventEntry* evtentry = &bucket->events[j];
+    if (evtentry->type < 0)
+      continue;
+    size_t size = h->types[evtentry->type].type.payload_size;
+    bytes = payload_offset(bytes, size);
+    memcpy(&payloads[bytes], evtentry->user_event, size);
+    evtentry->user_event = &payloads[bytes];
+    bytes += (int)size;
+  }
+
+  rwn_arena_free(&h->arena, bucket->payloads,
+                 (size_t)bucket->payload_capacity);
+  bucket->payloads = payloads;
+  bucket->payload_bytes = bytes;
+  bucket->payload_capacity = capacity;
+  bucket->payload_garbage = 0;
+}
+
+/*
+ * Copy the payload to the end of the bucket's payloads
+ */
+static void* store_payload(RwnHistory* h,
+                           struct PhaseBucket* bucket,
+                           const void* payload,
+                           size_t size) {
+  int offset = payload_offset(bucket->payload_bytes, size);
+  if ((size_t)offset + size > (size_t)bucket->payload_capacity) {
+    int capacity = bucket->payload_capacity * 2;
+    while ((size_t)capacity < (size_t)offset + size + 16)
+      capacity = capacity < 64 ? 64 : capacity * 2;
+    repack_payloads(h, bucket, capacity);
+    offset = payload_offset(bucket->payload_bytes, size);
+  }
+
+  char* stored = &bucket->payloads[offset];
+  memcpy(stored, payload, size);
+  bucket->payload_bytes = offset + (int)size;
+
+  return stored;
+}
+
+/*
+ * Forget the payload of the removed event, repacking once most of the
+ * payloads are gone
+ */
+static void drop_payload(RwnHistory* h,
+                         struct PhaseBucket* bucket,
+                         size_t size) {
+  bucket->payload_garbage += (int)size;
+  if (bucket->payload_garbage * 2 > bucket->payload_bytes)
+    repack_payloads(h, bucket, bucket->payload_capacity);
+}
+
+/*
+ * Append the event to its phase and, unless it is detached, take a handle slot
+ * describing how to locate it; the payload of a typed event is `spec->evt`,
+ * an async event is applied with `async_func` instead of the spec's function
+ */
+static int append_event(RwnHistory* h,
+                        struct TimepointHashMapEntry* mapentry,
+                        struct PhaseBucket* bucket,
+                        const RwnEventSpec* spec,
+                        int type,
+                        RwnEventAsyncApplyFunc async_func,
+                        bool detached) {
+  rwn_version_thaw(mapentry);
+  bucket->events = reserve_one_more(h, bucket->events, bucket->event_count,
+                                    &bucket->event_capacity,
+                                    sizeof(*bucket->events));
+  void* user_event = (void*)spec->evt;
+  if (type >= 0)
+    user_event =
+        store_payload(h, bucket, spec->evt, h->types[type].type.payload_size);
+
+  int slot = NO_HANDLE_SLOT;
+  if (!detached) {
+    slot = alloc_handle_slot(h);
+    struct HandleSlot* hs = &h->slots[slot];
+    hs->mapentry = mapentry;
+    hs->phase = bucket->phase;
+    hs->index = bucket->event_count;
+  }
+
+  struct EventEntry* evtentry = &bucket->events[bucket->event_count];
+  evtentry->user_event = user_event;
+  evtentry->user_event_apply_func = spec->evt_apply_func;
+  evtentry->user_event_async_apply_func = async_func;
+  evtentry->user_event_revert_func = spec->evt_revert_func;
+  evtentry->user_event_destroy_func = spec->evt_destroy_func;
+  evtentry->conflict_key = spec->conflict_key;
+  evtentry->slot = slot;
+  evtentry->type = type;
+  if (type == EVENT_TYPE_ASYNC)
+    bucket->async_count += 1;
+  bucket->event_count += 1;
+  mapentry->event_count += 1;
+  if (is_event_irreversible(evtentry))
+    mapentry->irreversible_count += 1;
+
+  return slot;
+}
+
+/*
+ * Retire the old timepoints once the history, along with the timepoints from
+ * `oldest` to `latest` about to be scheduled, spans two windows, so that the
+ * cost of retiring is spread over a window worth of scheduling. Runs before
+ * the new events are added, as it frees the slots of the retired ones.
+ */
+static void slide_window(RwnHistory* h,
+                         RwnTimepoint oldest,
+                         RwnTimepoint latest) {
+  if (h->window == 0)
+    return;
+
+  if (h->timepoint_index.count > 0) {
+    RwnTimepoint last = rwn_index_last(&h->timepoint_index)->timepoint;
+    RwnTimepoint first = rwn_index_first(&h->timepoint_index)->timepoint;
+    latest = last > latest ? last : latest;
+    oldest = first < oldest ? first : oldest;
+  }
+  // twice the window, which itself may take the whole range
+  if (latest - oldest - h->window >= h->window)
+    rwn_history_retire(h, latest - h->window + 1);
+}
+
+/*
+ * Returned by `schedule_event()` instead of a slot if the timepoint is retired
+ * or no handle can be issued
+ */
+#define SCHEDULE_REFUSED (-2)
+
+/*
+ * Returns the slot of the new event, `NO_HANDLE_SLOT` if it is detached
+ */
+static int schedule_event(RwnHistory* h,
+                          const RwnEventSpec* spec,
+                          int type,
+                          RwnEventAsyncApplyFunc async_func,
+                          bool detached) {
+  if (spec->timepoint < h->watermark)
+    return SCHEDULE_REFUSED;
+  // which may retire the timepoint itself
+  slide_window(h, spec->timepoint, spec->timepoint);
+  if (spec->timepoint < h->watermark ||
+      (!detached && !has_free_handle_slots(h, 1)))
+    return SCHEDULE_REFUSED;
+
+#ifdef RWN_STATS
+  uint64_t stats_start = rwn_clock_now();
+#endif
+
+  rwn_checkpoints_mark_dirty(h, spec->timepoint);
+
+  struct TimepointHashMapEntry* mapentry;
+  HASH_FIND_TIMEPOINT(h->timepoint_hash_map, &spec->timepoint, mapentry);
+  if (mapentry == NULL) {
+    mapentry = add_timepoint(h, spec->timepoint);
+    rwn_index_insert(&h->timepoint_index, mapentry);
+  }
+
+  struct PhaseBucket* bucket = get_phase_bucket(h, mapentry, spec->phase);
+  int slot =
+      append_event(h, mapentry, bucket, spec, type, async_func, detached);
+
+#ifdef RWN_STATS
+  h->stats->totals.events_scheduled += 1;
+  rwn_stats_record(&h->stats->totals.schedule_latency,
+                   rwn_clock_now() - stats_start);
+#endif
+
+  return slot;
+}
+
+static RwnEventHandle* schedule_handled(RwnHistory* h,
+                                        const RwnEventSpec* spec,
+                                        int type) {
+  int slot = schedule_event(h, spec, type, NULL, false);
+  return slot != SCHEDULE_REFUSED ? encode_handle(h, slot) : NULL;
 }
 
 RwnEventHandle* rwn_history_schedule(RwnHistory* h,
-                                     int at_timepoint,
+                                     RwnTimepoint at_timepoint,
                                      int at_phase,
                                      const void* evt,
                                      RwnEventApplyFunc evt_apply_func,
                                      RwnEventDestroyFunc evt_destroy_func) {
-  if (at_timepoint < 0)
-    return NULL;
+  return rwn_history_schedule_keyed(h, at_timepoint, at_phase, 0, evt,
+                                    evt_apply_func, evt_destroy_func);
+}
 
-  struct TimepointHashMapEntry* mapentry;
-  HASH_FIND_INT(h->timepoint_hash_map, &at_timepoint, mapentry);
-  if (mapentry == NULL) {
-    // new map entry
-    mapentry = malloc(sizeof(*mapentry));
-    mapentry->timepoint = at_timepoint;
-    mapentry->event_list = NULL;
-    HASH_ADD_INT(h->timepoint_hash_map, timepoint, mapentry);
+RwnEventHandle* rwn_history_schedule_reversible(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    const void* evt,
+    RwnEventApplyFunc evt_apply_func,
+    RwnEventApplyFunc evt_revert_func,
+    RwnEventDestroyFunc evt_destroy_func) {
+  RwnEventSpec spec;
+  spec.timepoint = at_timepoint;
+  spec.phase = at_phase;
+  spec.evt = evt;
+  spec.evt_apply_func = evt_apply_func;
+  spec.evt_destroy_func = evt_destroy_func;
+  spec.evt_revert_func = evt_revert_func;
+  spec.conflict_key = 0;
+
+  return schedule_handled(h, &spec, -1);
+}
+
+RwnEventHandle* rwn_history_schedule_keyed(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    uint64_t conflict_key,
+    const void* evt,
+    RwnEventApplyFunc evt_apply_func,
+    RwnEventDestroyFunc evt_destroy_func) {
+  RwnEventSpec spec;
+  spec.timepoint = at_timepoint;
+  spec.phase = at_phase;
+  spec.evt = evt;
+  spec.evt_apply_func = evt_apply_func;
+  spec.evt_destroy_func = evt_destroy_func;
+  spec.evt_revert_func = NULL;
+  spec.conflict_key = conflict_key;
+
+  return schedule_handled(h, &spec, -1);
+}
+
+bool rwn_history_schedule_detached(RwnHistory* h,
+                                   RwnTimepoint at_timepoint,
+                                   int at_phase,
+                                   const void* evt,
+                                   RwnEventApplyFunc evt_apply_func,
+                                   RwnEventDestroyFunc evt_destroy_func) {
+  RwnEventSpec spec;
+  spec.timepoint = at_timepoint;
+  spec.phase = at_phase;
+  spec.evt = evt;
+  spec.evt_apply_func = evt_apply_func;
+  spec.evt_destroy_func = evt_destroy_func;
+  spec.evt_revert_func = NULL;
+  spec.conflict_key = 0;
+
+  return schedule_event(h, &spec, -1, NULL, true) != SCHEDULE_REFUSED;
+}
+
+int rwn_history_register_type(RwnHistory* h, const RwnEventType* type) {
+  if (type->payload_size == 0 || type->apply_func == NULL)
+    return -1;
+
+  h->types = reserve_one_more(h, h->types, h->type_count, &h->type_capacity,
+                              sizeof(*h->types));
+  struct EventTypeEntry* entry = &h->types[h->type_count];
+  entry->type = *type;
+  entry->columns_apply_func = NULL;
+  entry->field_count = 0;
+  h->type_count += 1;
+
+  return h->type_count - 1;
+}
+
+int rwn_history_set_type_columns(
+    RwnHistory* h,
+    int type,
+    const RwnPayloadField* fields,
+    int field_count,
+    RwnEventColumnsApplyFunc columns_apply_func) {
+  assert(type >= 0 && type < h->type_count);
+  struct EventTypeEntry* entry = &h->types[type];
+  if (field_count <= 0 || field_count > RWN_MAX_PAYLOAD_FIELDS)
+    return -1;
+
+  // a chunk of the columns scratch holds at least 31 rows then
+  size_t row_size = 0;
+  int f;
+  for (f = 0; f < field_count; ++f) {
+    if (fields[f].size == 0 || fields[f].offset > entry->type.payload_size ||
+        fields[f].size > entry->type.payload_size - fields[f].offset)
+      return -1;
+    row_size += fields[f].size;
   }
+  if (row_size > COLUMNS_SCRATCH_SIZE / 32)
+    return -1;
 
-  // start or continue event list in the entry
-  struct EventListEntry* evtentry = malloc(sizeof(*evtentry));
-  evtentry->user_event = (void*)evt;
-  evtentry->user_event_apply_func = evt_apply_func;
-  evtentry->user_event_destroy_func = evt_destroy_func;
-  evtentry->phase = at_phase;
-  evtentry->next = NULL;
-  LL_APPEND(mapentry->event_list, evtentry);
+  memcpy(entry->fields, fields, sizeof(*fields) * (size_t)field_count);
+  entry->field_count = field_count;
+  entry->columns_apply_func = columns_apply_func;
+
+  return 0;
+}
 
-  // sort event list by phase at every insertion
-  LL_SORT(mapentry->event_list, cmp_event_list_entries_by_phase);
+RwnEventHandle* rwn_history_schedule_typed(RwnHistory* h,
+                                           RwnTimepoint at_timepoint,
+                                           int at_phase,
+                                           int type,
+                                           const void* payload) {
+  assert(type >= 0 && type < h->type_count);
 
-  // create, save and return opaque handle describing how to locate the event
-  RwnEventHandle* handle = malloc(sizeof(*handle));
-  handle->timepoint = at_timepoint;
-  handle->event_list_elem = evtentry;
-  handle->next = NULL;
-  LL_APPEND(h->event_handle_list, handle);
+  RwnEventSpec spec;
+  spec.timepoint = at_timepoint;
+  spec.phase = at_phase;
+  spec.evt = payload;
+  spec.evt_apply_func = h->types[type].type.apply_func;
+  spec.evt_destroy_func = NULL;
+  spec.evt_revert_func = h->types[type].type.revert_func;
+  spec.conflict_key = 0;
 
-  return handle;
+  return schedule_handled(h, &spec, type);
 }
 
-int rwn_history_count_events(const RwnHistory* h, int at_timepoint) {
+RwnEventHandle* rwn_history_schedule_async(
+    RwnHistory* h,
+    RwnTimepoint at_timepoint,
+    int at_phase,
+    const void* evt,
+    RwnEventAsyncApplyFunc evt_async_apply_func,
+    RwnEventDestroyFunc evt_destroy_func) {
+  RwnEventSpec spec;
+  spec.timepoint = at_timepoint;
+  spec.phase = at_phase;
+  spec.evt = evt;
+  spec.evt_apply_func = NULL;
+  spec.evt_destroy_func = evt_destroy_func;
+  spec.evt_revert_func = NULL;
+  spec.conflict_key = 0;
+
+  int slot = schedule_event(h, &spec, EVENT_TYPE_ASYNC, evt_async_apply_func,
+                            false);
+  return slot != SCHEDULE_REFUSED ? encode_handle(h, slot) : NULL;
+}
+
+void rwn_history_set_completion_source(RwnHistory* h,
+                                       const RwnCompletionSource* source) {
+  h->completion_source.wait = source != NULL ? source->wait : NULL;
+  h->completion_source.user_data = source != NULL ? source->user_data : NULL;
+}
+
+struct SpecOrder {
+  RwnTimepoint timepoint;
+  int phase;
+  int index; /* in the user's spec array */
+};
+
+static int cmp_spec_orders(const void* lhs, const void* rhs) {
+  const struct SpecOrder* l = lhs;
+  const struct SpecOrder* r = rhs;
+  if (l->timepoint != r->timepoint)
+    return l->timepoint < r->timepoint ? -1 : 1;
+  if (l->phase != r->phase)
+    return l->phase < r->phase ? -1 : 1;
+  // keep the order of the specs within a phase
+  return l->index < r->index ? -1 : (l->index > r->index);
+}
+
+static int schedule_specs(RwnHistory* h,
+                          const RwnEventSpec* specs,
+                          int count,
+                          RwnEventHandle** handles,
+                          bool detached) {
+  if (count <= 0)
+    return 0;
+
+#ifdef RWN_STATS
+  uint64_t stats_start = rwn_clock_now();
+#endif
+
+  // sort once, by timepoint and phase
+  struct SpecOrder* order =
+      rwn_allocator_alloc(&h->arena.allocator, sizeof(*order) * (size_t)count);
+  int norder = 0;
+  int i;
+  for (i = 0; i < count; ++i) {
+    if (handles != NULL)
+      handles[i] = NULL;
+    if (specs[i].timepoint < h->watermark ||
+        (!detached && !has_free_handle_slots(h, norder + 1)))
+      continue;
+    order[norder].timepoint = specs[i].timepoint;
+    order[norder].phase = specs[i].phase;
+    order[norder].index = i;
+    norder += 1;
+  }
+  // specs already in timepoint and phase order (e.g. loaded from a file)
+  // need no sorting
+  for (i = 1; i < norder; ++i)
+    if (cmp_spec_orders(&order[i - 1], &order[i]) > 0)
+      break;
+  if (i < norder)
+    qsort(order, (size_t)norder, sizeof(*order), cmp_spec_orders);
+
+  // which may retire the oldest of the specs themselves
+  i = 0;
+  if (norder > 0) {
+    slide_window(h, order[0].timepoint, order[norder - 1].timepoint);
+    while (i < norder && order[i].timepoint < h->watermark)
+      i += 1;
+  }
+  int refused = i;
+  if (i < norder)
+    rwn_checkpoints_mark_dirty(h, order[i].timepoint);
+
+  while (i < norder) {
+    RwnTimepoint timepoint = order[i].timepoint;
+    struct TimepointHashMapEntry* mapentry;
+    HASH_FIND_TIMEPOINT(h->timepoint_hash_map, &timepoint, mapentry);
+    if (mapentry == NULL) {
+      mapentry = add_timepoint(h, timepoint);
+      rwn_index_insert(&h->timepoint_index, mapentry);
+    }
+
+    while (i < norder && order[i].timepoint == timepoint) {
+      int phase = order[i].phase;
+      int run_end = i;
+      while (run_end < norder && order[run_end].timepoint == timepoint &&
+             order[run_end].phase == phase)
+        run_end += 1;
+
+      // presize the bucket for the whole run
+      struct PhaseBucket* bucket = get_phase_bucket(h, mapentry, phase);
+      bucket->events = reserve_capacity(
+          h, bucket->events, bucket->event_count + (run_end - i),
+          &bucket->event_capacity, sizeof(*bucket->events));
+
+      for (; i < run_end; ++i) {
+        const RwnEventSpec* spec = &specs[order[i].index];
+        int slot =
+            append_event(h, mapentry, bucket, spec, -1, NULL, detached);
+        if (handles != NULL)
+          handles[order[i].index] = encode_handle(h, slot);
+      }
+    }
+  }
+
+  rwn_allocator_free(&h->arena.allocator, order,
+                     sizeof(*order) * (size_t)count);
+
+#ifdef RWN_STATS
+  // one latency sample for the whole call
+  h->stats->totals.events_scheduled += (uint64_t)(norder - refused);
+  rwn_stats_record(&h->stats->totals.schedule_latency,
+                   rwn_clock_now() - stats_start);
+#endif
+
+  return norder - refused;
+}
+
+int rwn_history_schedule_many(RwnHistory* h,
+                              const RwnEventSpec* specs,
+                              int count,
+                              RwnEventHandle** handles) {
+  return schedule_specs(h, specs, count, handles, false);
+}
+
+int rwn_history_schedule_many_detached(RwnHistory* h,
+                                       const RwnEventSpec* specs,
+                                       int count) {
+  return schedule_specs(h, specs, count, NULL, true);
+}
+
+static RwnEventSpec* pending_specs(struct PendingBatch* batch) {
+  return (RwnEventSpec*)(batch + 1);
+}
+
+static size_t pending_batch_size(int count) {
+  return sizeof(struct PendingBatch) + sizeof(RwnEventSpec) * (size_t)count;
+}
+
+void rwn_history_post(RwnHistory* h, const RwnEventSpec* specs, int count) {
+  if (count <= 0)
+    return;
+
+  struct PendingBatch* batch =
+      rwn_allocator_alloc(&h->arena.allocator, pending_batch_size(count));
+  batch->count = count;
+  memcpy(pending_specs(batch), specs, sizeof(*specs) * (size_t)count);
+
+  // push onto the staging list
+  batch->next = __atomic_load_n(&h->pending, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&h->pending, &batch->next, batch, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+int rwn_history_flush(RwnHistory* h) {
+  // take the whole list at once; producers go on with an empty one
+  struct PendingBatch* batch =
+      __atomic_exchange_n(&h->pending, NULL, __ATOMIC_ACQUIRE);
+  if (batch == NULL)
+    return 0;
+
+  // newest first, so reverse into the posting order
+  struct PendingBatch* oldest = NULL;
+  int count = 0;
+  while (batch != NULL) {
+    struct PendingBatch* next = batch->next;
+    batch->next = oldest;
+    oldest = batch;
+    count += batch->count;
+    batch = next;
+  }
+
+  const RwnAllocator* allocator = &h->arena.allocator;
+  RwnEventSpec* specs = pending_specs(oldest);
+  if (oldest->next != NULL) {
+    specs = rwn_allocator_alloc(allocator, sizeof(*specs) * (size_t)count);
+    int offset = 0;
+    for (batch = oldest; batch != NULL; batch = batch->next) {
+      memcpy(&specs[offset], pending_specs(batch),
+             sizeof(*specs) * (size_t)batch->count);
+      offset += batch->count;
+    }
+  }
+
+  int scheduled = schedule_specs(h, specs, count, NULL, true);
+
+  if (oldest->next != NULL)
+    rwn_allocator_free(allocator, specs, sizeof(*specs) * (size_t)count);
+  while (oldest != NULL) {
+    struct PendingBatch* next = oldest->next;
+    rwn_allocator_free(allocator, oldest, pending_batch_size(oldest->count));
+    oldest = next;
+  }
+
+  return scheduled;
+}
+
+int rwn_history_count_events(const RwnHistory* h, RwnTimepoint at_timepoint) {
   if (at_timepoint < 0)
     return 0;
 
   struct TimepointHashMapEntry* mapentry;
-  HASH_FIND_INT(h->timepoint_hash_map, &at_timepoint, mapentry);
-  if (mapentry != NULL) {
-    struct EventListEntry* evtentry;
-    int count;
-    LL_COUNT(mapentry->event_list, evtentry, count);
-    return count;
-  }
+  HASH_FIND_TIMEPOINT(h->timepoint_hash_map, &at_timepoint, mapentry);
+  if (mapentry != NULL)
+    return mapentry->event_count;
   return 0;
 }
 
 static bool is_event_handle_valid(const RwnHistory* h,
                                   const RwnEventHandle* eh) {
-  struct TimepointHashMapEntry* mapentry;
-  HASH_FIND_INT(h->timepoint_hash_map, &eh->timepoint, mapentry);
-  if (mapentry == NULL)
-    return false;
-
-  if (mapentry->event_list == NULL)
-    return false;
-
-  bool event_info_found = false;
-  struct EventListEntry* evtentry;
-  LL_FOREACH(mapentry->event_list, evtentry) {
-    if (eh->event_list_elem == evtentry) {
-      event_info_found = true;
-      break;
-    }
+  return decode_handle(h, eh) >= 0;
+}
+
+/*
+ * Remove the event from its bucket in O(1) by moving the last event of the
+ * phase in its place, then drop the bucket and the timepoint if they are empty
+ */
+static void remove_event(RwnHistory* h, int slot) {
+  struct HandleSlot* hs = &h->slots[slot];
+  struct TimepointHashMapEntry* mapentry = hs->mapentry;
+
+  rwn_checkpoints_mark_dirty(h, mapentry->timepoint);
+  rwn_version_thaw(mapentry);
+
+  bool found;
+  int phase_index = find_phase_bucket(mapentry, hs->phase, &found);
+  assert(found);
+  struct PhaseBucket* bucket = &mapentry->phases[phase_index];
+
+  // free user data, if destroy_func is provided
+  struct EventEntry* evtentry = &bucket->events[hs->index];
+  if (is_event_irreversible(evtentry))
+    mapentry->irreversible_count -= 1;
+  if (evtentry->user_event_destroy_func != NULL)
+    evtentry->user_event_destroy_func(evtentry->user_event);
+  int type = evtentry->type;
+  if (type == EVENT_TYPE_ASYNC)
+    bucket->async_count -= 1;
+
+  bucket->event_count -= 1;
+  mapentry->event_count -= 1;
+  if (hs->index != bucket->event_count) {
+    *evtentry = bucket->events[bucket->event_count];
+    if (evtentry->slot != NO_HANDLE_SLOT)
+      h->slots[evtentry->slot].index = hs->index;
+  }
+  if (type >= 0 && bucket->event_count > 0)
+    drop_payload(h, bucket, h->types[type].type.payload_size);
+
+  // free the phase bucket, if there are no events left
+  if (bucket->event_count == 0) {
+    rwn_arena_free(&h->arena, bucket->events,
+                   sizeof(*bucket->events) * (size_t)bucket->event_capacity);
+    rwn_arena_free(&h->arena, bucket->payloads,
+                   (size_t)bucket->payload_capacity);
+    memmove(&mapentry->phases[phase_index], &mapentry->phases[phase_index + 1],
+            sizeof(*mapentry->phases) *
+                (size_t)(mapentry->phase_count - phase_index - 1));
+    mapentry->phase_count -= 1;
+  }
+
+  // free the whole timepoint hashmap entry, if there are no phases left
+  if (mapentry->phase_count == 0) {
+    rwn_arena_free(
+        &h->arena, mapentry->phases,
+        sizeof(*mapentry->phases) * (size_t)mapentry->phase_capacity);
+    unindex_timepoint(h, mapentry);
+    HASH_DEL(h->timepoint_hash_map, mapentry);
+    rwn_arena_free(&h->arena, mapentry, sizeof(*mapentry));
   }
 
-  return event_info_found;
+  // invalidate the handle
+  free_handle_slot(h, slot);
 }
 
 void rwn_history_unschedule(RwnHistory* h, RwnEventHandle* eh) {
-  struct TimepointHashMapEntry* mapentry;
-  HASH_FIND_INT(h->timepoint_hash_map, &eh->timepoint, mapentry);
+  // checked in release builds too, a stale handle must not touch the event
+  // which took its slot since
+  if (!is_event_handle_valid(h, eh))
+    return;
 
-  assert(is_event_handle_valid(h, eh));
+  int slot = decode_handle(h, eh);
 
-  if (mapentry != NULL) {
-    // free user data, if destroy_func is provided
-    struct EventListEntry* evtentry = eh->event_list_elem;
-    if (evtentry->user_event_destroy_func != NULL)
-      evtentry->user_event_destroy_func(evtentry->user_event);
-
-    // delete the evtentry from the list of event infos
-    LL_DELETE(mapentry->event_list, eh->event_list_elem);
-    free(eh->event_list_elem);
-
-    // free the whole timepoint hashmap entry, if there are no events left
-    int count;
-    LL_COUNT(mapentry->event_list, evtentry, count);
-    if (count == 0) {
-      HASH_DEL(h->timepoint_hash_map, mapentry);
-      free(mapentry);
-    }
+#ifdef RWN_STATS
+  uint64_t stats_start = rwn_clock_now();
+#endif
+
+  remove_event(h, slot);
+
+#ifdef RWN_STATS
+  h->stats->totals.events_unscheduled += 1;
+  rwn_stats_record(&h->stats->totals.unschedule_latency,
+                   rwn_clock_now() - stats_start);
+#endif
+}
+
+/*
+ * Free the timepoints at positions `[first, last)` of the index with all of
+ * their events
+ */
+static int drop_timepoints(RwnHistory* h,
+                           struct IndexPos first,
+                           struct IndexPos last) {
+  int evtcount = 0;
+  struct IndexPos pos;
+  for (pos = first; !rwn_index_pos_equal(pos, last);
+       rwn_index_next(&h->timepoint_index, &pos)) {
+    struct TimepointHashMapEntry* mapentry =
+        rwn_index_get(&h->timepoint_index, pos);
+    evtcount += free_timepoint_events(h, mapentry);
+    HASH_DEL(h->timepoint_hash_map, mapentry);
+    rwn_arena_free(&h->arena, mapentry, sizeof(*mapentry));
+  }
+
+  // close the gap in the index at once
+  rwn_index_remove_range(&h->timepoint_index, first, last);
+
+  return evtcount;
+}
+
+int rwn_history_retire(RwnHistory* h, RwnTimepoint watermark) {
+  watermark = rwn_checkpoints_retire(h, watermark);
+  if (watermark <= h->watermark)
+    return 0;
+
+  struct IndexPos last = rwn_timepoints_lower_bound(h, watermark);
+  if (!rwn_index_at_begin(last) && h->retire_func != NULL) {
+    struct IndexPos newest = last;
+    rwn_index_prev(&h->timepoint_index, &newest);
+    h->retire_func(h, rwn_index_first(&h->timepoint_index)->timepoint,
+                   rwn_index_get(&h->timepoint_index, newest)->timepoint,
+                   h->retire_user_data);
   }
+  h->watermark = watermark;
+
+  return drop_timepoints(h, rwn_index_begin(&h->timepoint_index), last);
+}
 
-  // free/invalidate the handle
-  LL_DELETE(h->event_handle_list, eh);
-  free(eh);
+void rwn_history_set_window(RwnHistory* h,
+                            RwnTimepoint window,
+                            RwnRetireFunc retire_func,
+                            void* user_data) {
+  h->window = window < 0 ? 0 : window;
+  h->retire_func = retire_func;
+  h->retire_user_data = user_data;
+  if (h->timepoint_index.count > 0)
+    slide_window(h, rwn_index_first(&h->timepoint_index)->timepoint,
+                 rwn_index_last(&h->timepoint_index)->timepoint);
+}
+
+RwnTimepoint rwn_history_watermark(const RwnHistory* h) {
+  return h->watermark;
 }
 
 int rwn_history_unschedule_all(RwnHistory* h,
-                               int start_timepoint,
-                               int finish_timepoint) {
+                               RwnTimepoint start_timepoint,
+                               RwnTimepoint finish_timepoint) {
   if (start_timepoint < 0 || finish_timepoint < 0)
     return 0;
 
   if (finish_timepoint < start_timepoint)
     return 0;
 
-  int evtcount = 0;
+  // Visit only the populated timepoints of the range and drop them as a whole
+  const struct TimepointIndex* index = &h->timepoint_index;
+  struct IndexPos first = rwn_timepoints_lower_bound(h, start_timepoint);
+  if (!rwn_index_at_end(index, first) &&
+      rwn_index_get(index, first)->timepoint <= finish_timepoint)
+    rwn_checkpoints_mark_dirty(h, rwn_index_get(index, first)->timepoint);
 
-  // Iterate over issued event handles to find and unsched such events
-  RwnEventHandle *eh, *eh_tmp;
-  LL_FOREACH_SAFE(h->event_handle_list, eh, eh_tmp) {
-    if (eh->timepoint >= start_timepoint && eh->timepoint <= finish_timepoint) {
-      rwn_history_unschedule(h, eh);
-      evtcount += 1;
-    }
-  }
+  struct IndexPos last = rwn_timepoints_lower_bound(h, finish_timepoint);
+  if (!rwn_index_at_end(index, last) &&
+      rwn_index_get(index, last)->timepoint == finish_timepoint)
+    rwn_index_next(index, &last);
 
-  return evtcount;
+  return drop_timepoints(h, first, last);
 }
 
 int rwn_history_get_events(const RwnHistory* h,
-                           int at_timepoint,
+                           RwnTimepoint at_timepoint,
                            void** user_eventv) {
-  if (rwn_history_count_events(h, at_timepoint) <= 0)
+  if (at_timepoint < 0)
     return 0;
 
   int evtcount = 0;
 
   struct TimepointHashMapEntry* mapentry;
-  HASH_FIND_INT(h->timepoint_hash_map, &at_timepoint, mapentry);
+  HASH_FIND_TIMEPOINT(h->timepoint_hash_map, &at_timepoint, mapentry);
   if (mapentry != NULL) {
-    struct EventListEntry* evtentry;
-    LL_FOREACH(mapentry->event_list, evtentry) {
-      user_eventv[evtcount] = evtentry->user_event;
-      evtcount += 1;
+    int i, j;
+    for (i = 0; i < mapentry->phase_count; ++i) {
+      const struct PhaseBucket* bucket = &mapentry->phases[i];
+      for (j = 0; j < bucket->event_count; ++j) {
+        user_eventv[evtcount] = bucket->events[j].user_event;
+        evtcount += 1;
+      }
     }
   }
 
   return evtcount;
 }
 
-struct ThreadListElem {
-  pthread_t thread;
-  void* user_event;
-  RwnEventApplyFunc user_event_apply_func;
+int rwn_history_visit_events(const RwnHistory* h,
+                             RwnTimepoint start_timepoint,
+                             RwnTimepoint finish_timepoint,
+                             RwnEventVisitFunc visit_func,
+                             void* user_data) {
+  if (start_timepoint < 0 || finish_timepoint < 0)
+    return 0;
+
+  if (finish_timepoint < start_timepoint)
+    return 0;
+
+  const struct TimepointIndex* index = &h->timepoint_index;
+  int evtcount = 0;
+  struct IndexPos pos;
+  for (pos = rwn_timepoints_lower_bound(h, start_timepoint);
+       !rwn_index_at_end(index, pos); rwn_index_next(index, &pos)) {
+    const struct TimepointHashMapEntry* mapentry = rwn_index_get(index, pos);
+    if (mapentry->timepoint > finish_timepoint)
+      break;
+
+    RwnEventInfo info;
+    info.timepoint = mapentry->timepoint;
+
+    int p, j;
+    for (p = 0; p < mapentry->phase_count; ++p) {
+      const struct PhaseBucket* bucket = &mapentry->phases[p];
+      info.phase = bucket->phase;
+      for (j = 0; j < bucket->event_count; ++j) {
+        const struct EventEntry* evtentry = &bucket->events[j];
+        info.evt = evtentry->user_event;
+        info.evt_apply_func = evtentry->user_event_apply_func;
+        info.evt_async_apply_func = evtentry->user_event_async_apply_func;
+        info.conflict_key = evtentry->conflict_key;
+        info.handle = encode_handle(h, evtentry->slot);
+        evtcount += 1;
+        if (!visit_func(&info, user_data))
+          return evtcount;
+      }
+    }
+  }
+
+  return evtcount;
+}
+
+/*
+ * Private copy of the state for one executor thread, see
+ * `rwn_history_state_delta_sharded()`
+ */
+struct StateShard {
   void* state;
+  bool touched; /* got events since the last merge */
+  char pad[EXECUTOR_CACHE_LINE - sizeof(void*) - sizeof(bool)];
+};
 
-  struct ThreadListElem* next;
+struct ShardSet {
+  const RwnStateShardFuncs* funcs;
+  struct StateShard* shards; /* one per executor thread, forked on demand */
+  int count;
 };
 
-static void* thread_apply_event(void* arg) {
-  struct ThreadListElem* self_data = arg;
-  self_data->user_event_apply_func(self_data->user_event, self_data->state);
-  return NULL;
+struct PhaseBatch {
+  const struct EventEntry* events;
+  void* state;
+  RwnCompletion* completion; /* NULL if the phase has no async events */
+  struct StateShard* shards; /* NULL if all apply to `state` */
+  bool reverse;
+  RwnTrace* trace; /* NULL if not recording */
+  RwnTimepoint timepoint;
+  int phase;
+#ifdef RWN_STATS
+  struct HistoryStats* stats;
+  RwnPhaseStats* phase_stats;
+#endif
+};
+
+static void call_apply(const struct PhaseBatch* batch,
+                       const struct EventEntry* evtentry,
+                       RwnEventApplyFunc func,
+                       void* state) {
+  // async events are irreversible, so `func` is their NULL apply
+  if (evtentry->type == EVENT_TYPE_ASYNC)
+    rwn_completion_apply(batch->completion,
+                         evtentry->user_event_async_apply_func,
+                         evtentry->user_event, state);
+  else
+    func(evtentry->user_event, state);
+}
+
+static void apply_one_event(const struct PhaseBatch* batch,
+                            const struct EventEntry* evtentry,
+                            void* state) {
+  RwnEventApplyFunc func = batch->reverse ? evtentry->user_event_revert_func
+                                          : evtentry->user_event_apply_func;
+#ifdef RWN_STATS
+  if (batch->stats == NULL) {
+    call_apply(batch, evtentry, func, state);
+    return;
+  }
+  uint64_t stats_start = rwn_clock_now();
+  call_apply(batch, evtentry, func, state);
+  rwn_stats_record_apply(batch->stats, batch->phase_stats, func, 1,
+                         rwn_clock_now() - stats_start);
+#else
+  call_apply(batch, evtentry, func, state);
+#endif
+}
+
+#ifndef RWN_NO_TRACE
+/*
+ * Record the apply call of `count` events which has just returned
+ */
+static void trace_apply(const struct PhaseBatch* batch,
+                        const struct EventEntry* first,
+                        int count,
+                        int worker,
+                        uint64_t start_ns) {
+  RwnTraceRecord record;
+  record.timepoint = batch->timepoint;
+  record.phase = batch->phase;
+  record.event = (int)(first - batch->events);
+  record.event_count = count;
+  record.worker = worker;
+  record.start_ns = start_ns;
+  record.end_ns = rwn_clock_now();
+  rwn_trace_record(batch->trace, &record);
+}
+#endif
+
+static void apply_event(const struct PhaseBatch* batch,
+                        const struct EventEntry* evtentry,
+                        void* state,
+                        int worker) {
+#ifndef RWN_NO_TRACE
+  if (batch->trace != NULL) {
+    uint64_t trace_start = rwn_clock_now();
+    apply_one_event(batch, evtentry, state);
+    trace_apply(batch, evtentry, 1, worker, trace_start);
+    return;
+  }
+#else
+  (void)worker;
+#endif
+  apply_one_event(batch, evtentry, state);
+}
+
+static void apply_phase_batch_task(void* ctx, int task, int worker) {
+  struct PhaseBatch* batch = ctx;
+  const struct EventEntry* evtentry = &batch->events[task];
+  if (is_event_applicable(evtentry)) {
+    void* state = batch->state;
+    if (batch->shards != NULL) {
+      state = batch->shards[worker].state;
+      batch->shards[worker].touched = true;
+    }
+    apply_event(batch, evtentry, state, worker);
+  }
+}
+
+static void fork_shards(struct ShardSet* set, const void* state) {
+  if (set->shards != NULL)
+    return;
+  set->shards = rwn_cache_line_alloc(sizeof(*set->shards) * set->count);
+  int w;
+  for (w = 0; w < set->count; ++w) {
+    set->shards[w].state =
+        set->funcs->fork_state(state, set->funcs->user_data);
+    set->shards[w].touched = false;
+  }
+}
+
+/*
+ * Fold the shards which got events into the state, in the worker order
+ */
+static void merge_shards(struct ShardSet* set, void* state) {
+  int w;
+  for (w = 0; w < set->count; ++w) {
+    if (set->shards[w].touched) {
+      set->funcs->merge_state(state, set->shards[w].state,
+                              set->funcs->user_data);
+      set->shards[w].touched = false;
+    }
+  }
+}
+
+static void discard_shards(struct ShardSet* set) {
+  if (set->shards == NULL)
+    return;
+  int w;
+  for (w = 0; w < set->count; ++w)
+    set->funcs->discard_state(set->shards[w].state, set->funcs->user_data);
+  free(set->shards);
+}
+
+#ifdef RWN_STATS
+/*
+ * Make the stats entries the workers will need, and count the phase
+ */
+static void prepare_phase_stats(struct HistoryStats* stats,
+                                struct PhaseBatch* batch,
+                                const struct PhaseBucket* bucket,
+                                RwnExecutor* executor) {
+  batch->stats = stats;
+  batch->phase_stats = NULL;
+  if (stats == NULL)
+    return;
+  batch->phase_stats = rwn_stats_phase(stats, bucket->phase);
+
+  int j;
+  for (j = 0; j < bucket->event_count; ++j) {
+    const struct EventEntry* evtentry = &bucket->events[j];
+    if (is_event_applicable(evtentry))
+      rwn_stats_add_func(stats, batch->reverse
+                                    ? evtentry->user_event_revert_func
+                                    : evtentry->user_event_apply_func);
+  }
+
+  stats->totals.phases_applied += 1;
+  if (executor != NULL) {
+    stats->totals.barrier_waits += 1;
+    // mirrors the shortcut of the executor which runs tiny batches inline
+    int threads = rwn_executor_num_threads(executor);
+    if (threads > 1 && bucket->event_count > 1)
+      stats->totals.thread_dispatches += (uint64_t)(threads - 1);
+  }
+}
+#endif
+
+/*
+ * Number of typed events starting at the given one which can be applied with
+ * a single batch call: of the same type, with their payloads back to back
+ */
+static int typed_run_length(const struct Timeline* tl,
+                            const struct PhaseBucket* bucket,
+                            int first) {
+  const struct EventEntry* evtentry = &bucket->events[first];
+  if (evtentry->type < 0)
+    return 0;
+  const struct EventTypeEntry* type = &tl->types[evtentry->type];
+  if (type->type.batch_apply_func == NULL && type->columns_apply_func == NULL)
+    return 0;
+
+  size_t size = type->type.payload_size;
+  int j = first + 1;
+  while (j < bucket->event_count && bucket->events[j].type == evtentry->type &&
+         (const char*)bucket->events[j].user_event ==
+             (const char*)bucket->events[j - 1].user_event + size)
+    j += 1;
+
+  return j - first;
+}
+
+/*
+ * Copy one field of `count` payloads into a column; the common sizes get
+ * fixed-size moves
+ */
+static void gather_field(char* column,
+                         const char* field,
+                         int count,
+                         size_t stride,
+                         size_t size) {
+  int i;
+  switch (size) {
+    case 4:
+      for (i = 0; i < count; ++i, field += stride)
+        memcpy(&column[i * 4], field, 4);
+      break;
+    case 8:
+      for (i = 0; i < count; ++i, field += stride)
+        memcpy(&column[i * 8], field, 8);
+      break;
+    default:
+      for (i = 0; i < count; ++i, field += stride)
+        memcpy(&column[(size_t)i * size], field, size);
+  }
+}
+
+static size_t column_size(int count, size_t size) {
+  size_t bytes = (size_t)count * size;
+  return (bytes + COLUMN_ALIGN - 1) & ~(size_t)(COLUMN_ALIGN - 1);
+}
+
+/*
+ * Transpose the run into columns chunk by chunk, the chunks small enough for
+ * the kernel to find them in the L1 cache
+ */
+static void apply_columns(const struct EventTypeEntry* type,
+                          const char* payloads,
+                          int count,
+                          void* state) {
+  char scratch[COLUMNS_SCRATCH_SIZE] __attribute__((aligned(COLUMN_ALIGN)));
+  const void* columns[RWN_MAX_PAYLOAD_FIELDS];
+  size_t payload_size = type->type.payload_size;
+
+  size_t row_size = 0;
+  int f;
+  for (f = 0; f < type->field_count; ++f)
+    row_size += type->fields[f].size;
+  int chunk =
+      (int)((COLUMNS_SCRATCH_SIZE - COLUMN_ALIGN * type->field_count) /
+            row_size);
+
+  int done;
+  for (done = 0; done < count; done += chunk) {
+    int n = count - done < chunk ? count - done : chunk;
+    char* column = scratch;
+    for (f = 0; f < type->field_count; ++f) {
+      const RwnPayloadField* field = &type->fields[f];
+      const char* first = payloads + (size_t)done * payload_size;
+      gather_field(column, first + field->offset, n, payload_size,
+                   field->size);
+      columns[f] = column;
+      column += column_size(n, field->size);
+    }
+    type->columns_apply_func(columns, n, state);
+  }
+}
+
+static void call_typed_run(const struct EventTypeEntry* type,
+                           const struct EventEntry* first,
+                           int count,
+                           void* state) {
+  if (type->columns_apply_func != NULL)
+    apply_columns(type, first->user_event, count, state);
+  else
+    type->type.batch_apply_func(first->user_event, count, state);
+}
+
+static void apply_typed_run(const struct PhaseBatch* batch,
+                            const struct EventTypeEntry* type,
+                            const struct EventEntry* first,
+                            int count,
+                            void* state) {
+#ifndef RWN_NO_TRACE
+  uint64_t trace_start = batch->trace != NULL ? rwn_clock_now() : 0;
+#endif
+#ifdef RWN_STATS
+  if (batch->stats != NULL) {
+    uint64_t stats_start = rwn_clock_now();
+    call_typed_run(type, first, count, state);
+    rwn_stats_record_apply(batch->stats, batch->phase_stats,
+                           type->type.apply_func, count,
+                           rwn_clock_now() - stats_start);
+  } else {
+    call_typed_run(type, first, count, state);
+  }
+#else
+  (void)batch;
+  call_typed_run(type, first, count, state);
+#endif
+#ifndef RWN_NO_TRACE
+  // only the sequential replay batches the runs, on the calling thread
+  if (batch->trace != NULL)
+    trace_apply(batch, first, count, 0, trace_start);
+#endif
+}
+
+/*
+ * Apply (or revert) all events of the phase
+ */
+static int apply_phase(const struct Timeline* tl,
+                       RwnTimepoint timepoint,
+                       const struct PhaseBucket* bucket,
+                       void* state,
+                       RwnExecutor* executor,
+                       struct ShardSet* shards,
+                       bool reverse) {
+  struct PhaseBatch batch;
+  batch.events = bucket->events;
+  batch.state = state;
+  batch.completion = NULL;
+  batch.shards = NULL;
+  batch.reverse = reverse;
+  batch.trace = tl->trace;
+  batch.timepoint = timepoint;
+  batch.phase = bucket->phase;
+  RwnCompletion completion;
+  if (bucket->async_count > 0) {
+    rwn_completion_init(&completion, tl->completion_source);
+    batch.completion = &completion;
+  }
+#ifdef RWN_STATS
+  prepare_phase_stats(tl->stats, &batch, bucket, executor);
+#endif
+
+  int evtcount = 0;
+  int j;
+  if (executor != NULL) {
+    /*
+     * Multithreaded execution of phases: the whole phase is handed to the
+     * workers as a single batch
+     */
+    if (shards != NULL) {
+      fork_shards(shards, state);
+      batch.shards = shards->shards;
+    }
+    rwn_executor_run_batch(executor, bucket->event_count,
+                           apply_phase_batch_task, &batch);
+    // the phase barrier: nobody touches the shards until the next batch
+    if (batch.completion != NULL)
+      rwn_completion_finish(batch.completion);
+    if (shards != NULL)
+      merge_shards(shards, state);
+    for (j = 0; j < bucket->event_count; ++j)
+      if (is_event_applicable(&bucket->events[j]))
+        evtcount += 1;
+  } else if (!reverse) {
+    /*
+     * Single-thread, sequential execution of phases
+     */
+    j = 0;
+    while (j < bucket->event_count) {
+      const struct EventEntry* evtentry = &bucket->events[j];
+      int run = typed_run_length(tl, bucket, j);
+      if (run > 0) {
+        apply_typed_run(&batch, &tl->types[evtentry->type], evtentry, run,
+                        state);
+        evtcount += run;
+        j += run;
+        continue;
+      }
+      if (is_event_applicable(evtentry)) {
+        apply_event(&batch, evtentry, state, 0);
+        evtcount += 1;
+      }
+      j += 1;
+    }
+  } else {
+    /*
+     * Sequential undo, in the exact opposite order
+     */
+    for (j = bucket->event_count - 1; j >= 0; --j) {
+      const struct EventEntry* evtentry = &bucket->events[j];
+      if (is_event_applicable(evtentry)) {
+        apply_event(&batch, evtentry, state, 0);
+        evtcount += 1;
+      }
+    }
+  }
+
+  // the phase barrier of the sequential execution
+  if (batch.completion != NULL && executor == NULL)
+    rwn_completion_finish(batch.completion);
+
+#ifdef RWN_STATS
+  if (tl->stats != NULL)
+    tl->stats->totals.events_applied += (uint64_t)evtcount;
+#endif
+
+  return evtcount;
 }
 
 int rwn_history_state_delta(const RwnHistory* h,
-                            int start_timepoint,
-                            int finish_timepoint,
+                            RwnTimepoint start_timepoint,
+                            RwnTimepoint finish_timepoint,
                             void* state,
                             const int max_threads) {
+  if (max_threads <= 0)
+    return rwn_history_state_delta_ex(h, start_timepoint, finish_timepoint,
+                                      state, NULL);
+
+  // one-shot pool, still spawns the threads only once per call
+  RwnExecutor* ex = rwn_executor_create(max_threads);
+  int evtcount = rwn_history_state_delta_ex(h, start_timepoint,
+                                            finish_timepoint, state, ex);
+  rwn_executor_destroy(ex);
+
+  return evtcount;
+}
+
+/*
+ * Walk the timepoints from `start` down to `finish`, undoing the phases in
+ * reverse order
+ */
+static int revert_state_delta(const struct Timeline* tl,
+                              RwnTimepoint start_timepoint,
+                              RwnTimepoint finish_timepoint,
+                              void* state,
+                              RwnExecutor* executor,
+                              struct ShardSet* shards,
+                              int* visited) {
+  // one past the newest timepoint to undo
+  struct IndexPos last = rwn_index_lower_bound(tl->index, start_timepoint);
+  if (!rwn_index_at_end(tl->index, last) &&
+      rwn_index_get(tl->index, last)->timepoint == start_timepoint)
+    rwn_index_next(tl->index, &last);
+
+  // refuse before touching the state if anything can not be undone
+  struct IndexPos pos = last;
+  while (!rwn_index_at_begin(pos)) {
+    rwn_index_prev(tl->index, &pos);
+    const struct TimepointHashMapEntry* mapentry =
+        rwn_index_get(tl->index, pos);
+    if (mapentry->timepoint < finish_timepoint)
+      break;
+    if (mapentry->irreversible_count > 0)
+      return -1;
+  }
+
+  int evtcount = 0;
+  pos = last;
+  while (!rwn_index_at_begin(pos)) {
+    rwn_index_prev(tl->index, &pos);
+    const struct TimepointHashMapEntry* mapentry =
+        rwn_index_get(tl->index, pos);
+    if (mapentry->timepoint < finish_timepoint)
+      break;
+
+    int p;
+    for (p = mapentry->phase_count - 1; p >= 0; --p)
+      evtcount += apply_phase(tl, mapentry->timepoint, &mapentry->phases[p],
+                              state, executor,
+                              shards, true);
+    *visited += 1;
+  }
+
+  return evtcount;
+}
+
+static int forward_state_delta(const struct Timeline* tl,
+                               RwnTimepoint start_timepoint,
+                               RwnTimepoint finish_timepoint,
+                               void* state,
+                               RwnExecutor* executor,
+                               struct ShardSet* shards,
+                               int* visited) {
+  int evtcount = 0;
+  struct IndexPos pos;
+  for (pos = rwn_index_lower_bound(tl->index, start_timepoint);
+       !rwn_index_at_end(tl->index, pos); rwn_index_next(tl->index, &pos)) {
+    const struct TimepointHashMapEntry* mapentry =
+        rwn_index_get(tl->index, pos);
+    if (mapentry->timepoint > finish_timepoint)
+      break;
+
+    int p;
+    for (p = 0; p < mapentry->phase_count; ++p)
+      evtcount += apply_phase(tl, mapentry->timepoint, &mapentry->phases[p],
+                              state, executor,
+                              shards, false);
+    *visited += 1;
+  }
+
+  return evtcount;
+}
+
+static int state_delta(const struct Timeline* tl,
+                       RwnTimepoint start_timepoint,
+                       RwnTimepoint finish_timepoint,
+                       void* state,
+                       RwnExecutor* executor,
+                       struct ShardSet* shards) {
   if (start_timepoint < 0 || finish_timepoint < 0)
     return 0;
 
+#ifdef RWN_STATS
+  uint64_t stats_start = rwn_clock_now();
+#endif
+
+  int visited = 0;
+  int evtcount;
   if (finish_timepoint < start_timepoint)
+    evtcount = revert_state_delta(tl, start_timepoint, finish_timepoint,
+                                  state, executor, shards, &visited);
+  else
+    evtcount = forward_state_delta(tl, start_timepoint, finish_timepoint,
+                                   state, executor, shards, &visited);
+
+#ifdef RWN_STATS
+  struct HistoryStats* stats = tl->stats;
+  if (stats == NULL)
+    return evtcount;
+  int64_t span = (int64_t)finish_timepoint - start_timepoint;
+  if (span < 0)
+    span = -span;
+  if (evtcount >= 0) {
+    stats->totals.timepoints_visited += (uint64_t)visited;
+    stats->totals.timepoints_empty += (uint64_t)(span + 1 - visited);
+  }
+  rwn_stats_record(&stats->totals.state_delta_latency,
+                   rwn_clock_now() - stats_start);
+#endif
+
+  return evtcount;
+}
+
+struct Timeline rwn_history_timeline(const RwnHistory* h) {
+  struct Timeline tl;
+  tl.index = &h->timepoint_index;
+  tl.types = h->types;
+  tl.completion_source =
+      h->completion_source.wait != NULL ? &h->completion_source : NULL;
+  tl.trace = h->trace;
+#ifdef RWN_STATS
+  tl.stats = h->stats;
+#endif
+  return tl;
+}
+
+int rwn_timeline_apply_phase(const struct Timeline* tl,
+                             RwnTimepoint timepoint,
+                             const struct PhaseBucket* bucket,
+                             void* state,
+                             RwnExecutor* executor) {
+  return apply_phase(tl, timepoint, bucket, state, executor, NULL, false);
+}
+
+int rwn_timeline_state_delta(const struct Timeline* tl,
+                             RwnTimepoint start_timepoint,
+                             RwnTimepoint finish_timepoint,
+                             void* state,
+                             RwnExecutor* executor) {
+  return state_delta(tl, start_timepoint, finish_timepoint, state, executor,
+                     NULL);
+}
+
+int rwn_history_state_delta_ex(const RwnHistory* h,
+                               RwnTimepoint start_timepoint,
+                               RwnTimepoint finish_timepoint,
+                               void* state,
+                               RwnExecutor* executor) {
+  struct Timeline tl = rwn_history_timeline(h);
+  return state_delta(&tl, start_timepoint, finish_timepoint, state, executor,
+                     NULL);
+}
+
+int rwn_history_state_delta_sharded(const RwnHistory* h,
+                                    RwnTimepoint start_timepoint,
+                                    RwnTimepoint finish_timepoint,
+                                    void* state,
+                                    RwnExecutor* executor,
+                                    const RwnStateShardFuncs* shard_funcs) {
+  struct Timeline tl = rwn_history_timeline(h);
+
+  // nothing runs concurrently, so the state itself is the only shard
+  if (executor == NULL || rwn_executor_num_threads(executor) == 1)
+    return state_delta(&tl, start_timepoint, finish_timepoint, state, executor,
+                       NULL);
+
+  struct ShardSet shards;
+  shards.funcs = shard_funcs;
+  shards.shards = NULL;
+  shards.count = rwn_executor_num_threads(executor);
+  int evtcount = state_delta(&tl, start_timepoint, finish_timepoint, state,
+                             executor, &shards);
+  discard_shards(&shards);
+
+  return evtcount;
+}
+
+/*
+ * Events walked at once by `rwn_history_state_delta_multi()`, with all of the
+ * states, before moving on to the next ones
+ */
+#define MULTI_SEGMENT_EVENTS 1024
+
+struct MultiSegment {
+  const struct Timeline* tl;
+  void* const* states;
+  RwnTimepoint start_timepoint;
+  RwnTimepoint finish_timepoint;
+  int evtcount; /* per state */
+};
+
+static void apply_multi_segment_task(void* ctx, int task, int worker) {
+  struct MultiSegment* segment = ctx;
+  int evtcount =
+      state_delta(segment->tl, segment->start_timepoint,
+                  segment->finish_timepoint, segment->states[task], NULL, NULL);
+  if (task == 0)
+    segment->evtcount = evtcount;
+  (void)worker;
+}
+
+int rwn_history_state_delta_multi(const RwnHistory* h,
+                                  RwnTimepoint start_timepoint,
+                                  RwnTimepoint finish_timepoint,
+                                  void* const* states,
+                                  int state_count,
+                                  RwnExecutor* executor) {
+  if (start_timepoint < 0 || finish_timepoint < 0 || state_count <= 0)
     return 0;
 
+  // the workers run concurrently, so they leave the stats and trace alone
+  struct Timeline tl = rwn_history_timeline(h);
+  tl.trace = NULL;
+#ifdef RWN_STATS
+  tl.stats = NULL;
+#endif
+
+  bool reverse = finish_timepoint < start_timepoint;
+  RwnTimepoint lo = reverse ? finish_timepoint : start_timepoint;
+  RwnTimepoint hi = reverse ? start_timepoint : finish_timepoint;
+  const struct TimepointIndex* index = tl.index;
+  struct IndexPos first = rwn_index_lower_bound(index, lo);
+  struct IndexPos last = rwn_index_lower_bound(index, hi);
+  if (!rwn_index_at_end(index, last) &&
+      rwn_index_get(index, last)->timepoint == hi)
+    rwn_index_next(index, &last);
+
+  // refuse before touching any state, as the segments only check themselves
+  struct IndexPos pos;
+  if (reverse)
+    for (pos = first; !rwn_index_pos_equal(pos, last);
+         rwn_index_next(index, &pos))
+      if (rwn_index_get(index, pos)->irreversible_count > 0)
+        return -1;
+
+  struct MultiSegment segment;
+  segment.tl = &tl;
+  segment.states = states;
+
   int evtcount = 0;
   int i;
-  for (i = start_timepoint; i <= finish_timepoint; ++i) {
-    struct TimepointHashMapEntry* mapentry;
-    HASH_FIND_INT(h->timepoint_hash_map, &i, mapentry);
-    if (mapentry != NULL && mapentry->event_list != NULL) {
-      /*
-       * Multithreaded execution of phases
-       */
-      if (max_threads > 0) {
-        struct ThreadListElem* thread_list = NULL;
-        struct ThreadListElem *thread_list_elem, *thread_list_elem_tmp;
-        int thread_list_length = 0;
-
-        struct EventListEntry* evtentry = mapentry->event_list;  // first entry
-        int prev_phase = evtentry->phase;
-        int current_phase;
-        LL_FOREACH(mapentry->event_list, evtentry) {
-          if (evtentry->user_event != NULL &&
-              evtentry->user_event_apply_func != NULL) {
-            current_phase = evtentry->phase;
-            /*
-             * If current phase is different from the previous one or we hit a
-             * limit on threads, then wait for all threads before continue.
-             *
-             */
-            LL_COUNT(thread_list, thread_list_elem, thread_list_length);
-            if (thread_list_length >= max_threads ||
-                current_phase != prev_phase) {
-              /*
-               * Wait (join) and then remove finished threads from the list
-               */
-              LL_FOREACH_SAFE(thread_list, thread_list_elem,
-                              thread_list_elem_tmp) {
-                pthread_join(thread_list_elem->thread, NULL);
-                LL_DELETE(thread_list, thread_list_elem);
-                free(thread_list_elem);
-              }
-            }
-
-            /*
-             * Dispatch the thread an continue to next event
-             */
-            thread_list_elem = malloc(sizeof(*thread_list_elem));
-            thread_list_elem->user_event = evtentry->user_event;
-            thread_list_elem->user_event_apply_func =
-                evtentry->user_event_apply_func;
-            thread_list_elem->state = state;
-            pthread_create(&thread_list_elem->thread, NULL, thread_apply_event,
-                           thread_list_elem);
-            LL_APPEND(thread_list, thread_list_elem);
-
-            evtcount += 1;
-          }
-        }
-
-        /*
-         * Join any remaining threads
-         */
-        LL_FOREACH_SAFE(thread_list, thread_list_elem, thread_list_elem_tmp) {
-          pthread_join(thread_list_elem->thread, NULL);
-          LL_DELETE(thread_list, thread_list_elem);
-          free(thread_list_elem);
-        }
+  pos = reverse ? last : first;
+  struct IndexPos stop = reverse ? first : last;
+  while (!rwn_index_pos_equal(pos, stop)) {
+    // as many whole timepoints as fit the segment, at least one
+    const struct TimepointHashMapEntry* begin = NULL;
+    const struct TimepointHashMapEntry* end;
+    int events = 0;
+    do {
+      if (reverse) {
+        rwn_index_prev(index, &pos);
+        end = rwn_index_get(index, pos);
       } else {
-        /*
-         * Single-thread, sequential execution of phases
-         */
-        struct EventListEntry* evtentry;
-        LL_FOREACH(mapentry->event_list, evtentry) {
-          if (evtentry->user_event != NULL &&
-              evtentry->user_event_apply_func != NULL) {
-            evtentry->user_event_apply_func(evtentry->user_event, state);
-            evtcount += 1;
-          }
-        }
+        end = rwn_index_get(index, pos);
+        rwn_index_next(index, &pos);
       }
+      if (begin == NULL)
+        begin = end;
+      events += end->event_count;
+    } while (!rwn_index_pos_equal(pos, stop) && events < MULTI_SEGMENT_EVENTS);
+    segment.start_timepoint = begin->timepoint;
+    segment.finish_timepoint = end->timepoint;
+
+    if (executor != NULL) {
+      rwn_executor_run_batch(executor, state_count, apply_multi_segment_task,
+                             &segment);
+    } else {
+      for (i = 0; i < state_count; ++i)
+        apply_multi_segment_task(&segment, i, 0);
     }
+    evtcount += segment.evtcount;
   }
 
+#ifdef RWN_STATS
+  h->stats->totals.events_applied += (uint64_t)evtcount * (uint64_t)state_count;
+#endif
+
   return evtcount;
 }
+
+RwnTimepoint rwn_history_next_timepoint(const RwnHistory* h,
+                                        RwnTimepoint from_timepoint) {
+  struct IndexPos pos = rwn_timepoints_lower_bound(h, from_timepoint);
+  if (rwn_index_at_end(&h->timepoint_index, pos))
+    return -1;
+
+  return rwn_index_get(&h->timepoint_index, pos)->timepoint;
+}
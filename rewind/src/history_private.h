@@ -0,0 +1,222 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/history.h>
+#include <rewind/types.h>
+#include <rewind/window.h>
+
+#include "arena.h"
+#include "async_private.h"
+#include "checkpoint_private.h"
+#include "executor_private.h"
+#include "serialize_private.h"
+#include "stats_private.h"
+#include "timepoint_index.h"
+#include "trace_private.h"
+#include "version_private.h"
+
+/*
+ * uthash takes its tables from the history's arena as well; all of the HASH_*
+ * macros that allocate are used where the history is in scope as `h`
+ */
+#define uthash_malloc(sz) rwn_arena_alloc(&h->arena, sz)
+#define uthash_free(ptr, sz) rwn_arena_free(&h->arena, ptr, sz)
+#ifdef RWN_HASH_FUNCTION
+#define HASH_FUNCTION(keyptr, keylen, hashv) \
+  RWN_HASH_FUNCTION(keyptr, keylen, hashv)
+#endif
+#include "uthash.h"
+
+#include <limits.h>
+#include <stdint.h>
+
+/*
+ * The timepoint map is keyed by 64-bit timepoints
+ */
+#define HASH_FIND_TIMEPOINT(head, findtp, out) \
+  HASH_FIND(hh, head, findtp, sizeof(RwnTimepoint), out)
+#define HASH_ADD_TIMEPOINT(head, tpfield, add) \
+  HASH_ADD(hh, head, tpfield, sizeof(RwnTimepoint), add)
+
+struct EventEntry {
+  void* user_event;
+  RwnEventApplyFunc user_event_apply_func; /* NULL for async events */
+  RwnEventAsyncApplyFunc user_event_async_apply_func; /* NULL for the others */
+  RwnEventApplyFunc user_event_revert_func; /* inverse of apply, or NULL */
+  RwnEventDestroyFunc user_event_destroy_func;
+  uint64_t conflict_key; /* zero conflicts with every event */
+  /* back reference to the handle slot, updated on moves, or NO_HANDLE_SLOT */
+  int slot;
+  /* registered type with the payload in the bucket, EVENT_TYPE_ASYNC or -1 */
+  int type;
+};
+
+/*
+ * All events of one phase of a timepoint (in the order of scheduling, until
+ * some of them get unscheduled)
+ */
+struct PhaseBucket {
+  int phase;
+  int event_count;
+  int event_capacity;
+  struct EventEntry* events;
+  /* payloads of the typed events, in the order of scheduling */
+  char* payloads;
+  int payload_bytes; /* used, including the removed ones */
+  int payload_capacity;
+  int payload_garbage; /* bytes of the removed ones */
+  int async_count; /* events which may complete later */
+};
+
+struct TimepointHashMapEntry {
+  RwnTimepoint timepoint; /* key */
+  int event_count; /* of all phases */
+  int irreversible_count; /* applicable events without revert func */
+  int phase_count;
+  int phase_capacity;
+  struct PhaseBucket* phases; /* sorted by phase */
+  struct FrozenTimepoint* frozen; /* copy shared with versions, until edited */
+  UT_hash_handle hh;
+};
+
+/*
+ * Event handles are not allocated: the opaque `RwnEventHandle*` value issued to
+ * the user is an index into the table of handle slots combined with the
+ * generation of the slot. Generation is bumped when the slot is freed, so a
+ * stale handle never matches a reused slot. Half of the bits go to the slot,
+ * which limits the live handles to `HANDLE_SLOT_LIMIT` (65535 on 32-bit
+ * targets); no handle is issued past it.
+ */
+#define HANDLE_SLOT_BITS (sizeof(uintptr_t) * 4)
+#define HANDLE_SLOT_MASK (((uintptr_t)1 << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GENERATION_MASK (((uintptr_t)1 << (HANDLE_SLOT_BITS - 1)) - 1)
+#define HANDLE_SLOT_LIMIT \
+  (HANDLE_SLOT_MASK < INT_MAX ? (int)HANDLE_SLOT_MASK : INT_MAX)
+
+/*
+ * Slot of the detached events, which take none
+ */
+#define NO_HANDLE_SLOT (-1)
+
+struct HandleSlot {
+  uintptr_t generation; /* never zero */
+  /* location of the event or NULL entry if the slot is free */
+  struct TimepointHashMapEntry* mapentry;
+  int phase;
+  int index; /* in the phase bucket */
+  int next_free;
+};
+
+/*
+ * Runs of typed events applied by columns are transposed through a stack
+ * buffer of this size, with every column aligned for vector loads
+ */
+#define COLUMNS_SCRATCH_SIZE (16 * 1024)
+#define COLUMN_ALIGN 32
+
+/*
+ * Registered event type, see `rwn_history_register_type()`
+ */
+struct EventTypeEntry {
+  RwnEventType type;
+  RwnEventColumnsApplyFunc columns_apply_func; /* or NULL */
+  int field_count;
+  RwnPayloadField fields[RWN_MAX_PAYLOAD_FIELDS];
+};
+
+/*
+ * Specs posted by one `rwn_history_post()` call, followed by the specs
+ * themselves
+ */
+struct PendingBatch {
+  struct PendingBatch* next; /* posted earlier */
+  int count;
+};
+
+struct RwnHistory {
+  struct Arena arena; /* all of the storage below comes from it */
+  struct TimepointHashMapEntry* timepoint_hash_map;
+  struct TimepointIndex timepoint_index; /* the same entries, in order */
+  struct HandleSlot* slots;
+  int slot_count;
+  int slot_capacity;
+  int free_slot; /* head of the free slot list or -1 */
+  int live_slot_count; /* at most HANDLE_SLOT_LIMIT */
+  struct CheckpointList checkpoints;
+  struct PendingBatch* pending; /* staged by producers, newest first */
+  struct EventTypeEntry* types; /* registered, by id */
+  int type_count;
+  int type_capacity;
+  RwnCompletionSource completion_source; /* `wait` is NULL if there is none */
+  RwnTrace* trace; /* NULL if not recording */
+  struct FileMapping mapping; /* backs the events of a loaded history */
+  RwnTimepoint watermark; /* timepoints before it are retired */
+  RwnTimepoint window; /* automatic retirement, or zero */
+  RwnRetireFunc retire_func;
+  void* retire_user_data;
+#ifdef RWN_STATS
+  struct HistoryStats* stats;
+#endif
+};
+
+/**
+ * @brief Binary search for the position of the first populated timepoint not
+ * less than the given one
+ */
+extern struct IndexPos rwn_timepoints_lower_bound(const RwnHistory* h,
+                                                  RwnTimepoint timepoint);
+
+/*
+ * Populated timepoints sorted by timepoint, to be evaluated: the live ones of
+ * a history or the frozen ones of a version
+ */
+struct Timeline {
+  const struct TimepointIndex* index;
+  const struct EventTypeEntry* types; /* for the typed events */
+  const RwnCompletionSource* completion_source; /* for the async ones */
+  RwnTrace* trace; /* NULL if not recording */
+#ifdef RWN_STATS
+  struct HistoryStats* stats; /* NULL if not collected */
+#endif
+};
+
+extern struct Timeline rwn_history_timeline(const RwnHistory* h);
+
+/**
+ * @brief Apply all events of the phase, as `rwn_history_state_delta_ex()` does
+ * @return number of applied events
+ */
+extern int rwn_timeline_apply_phase(const struct Timeline* tl,
+                                    RwnTimepoint timepoint,
+                                    const struct PhaseBucket* bucket,
+                                    void* state,
+                                    RwnExecutor* executor);
+
+/**
+ * @brief `rwn_history_state_delta_ex()` over the timeline; reads nothing else
+ */
+extern int rwn_timeline_state_delta(const struct Timeline* tl,
+                                    RwnTimepoint start_timepoint,
+                                    RwnTimepoint finish_timepoint,
+                                    void* state,
+                                    RwnExecutor* executor);
@@ -0,0 +1,487 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <rewind/serialize.h>
+
+#include "history_private.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File layout; all sections start at 8-byte aligned offsets, so that the
+ * records can be used in place once mapped
+ */
+#define FILE_MAGIC "RWNDHIST"
+#define FILE_VERSION 2 /* 1 had 32-bit timepoints */
+#define FILE_BYTE_ORDER 0x01020304u
+#define FILE_ALIGN 8
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order; /* FILE_BYTE_ORDER as written by the saving machine */
+  uint64_t timepoint_count;
+  uint64_t phase_count;
+  uint64_t event_count;
+  uint64_t timepoint_offset;
+  uint64_t phase_offset;
+  uint64_t event_offset;
+  uint64_t payload_offset;
+  uint64_t payload_size;
+};
+
+struct TimepointRecord {
+  int64_t timepoint;
+  uint32_t phase_count;
+  uint32_t reserved; /* zero */
+  uint64_t phase_begin; /* index of the first phase record */
+};
+
+struct PhaseRecord {
+  int32_t phase;
+  uint32_t event_count;
+  uint64_t event_begin; /* index of the first event record */
+};
+
+#define EVENT_RECORD_NULL_EVENT 1u /* the event pointer was NULL */
+
+struct EventRecord {
+  uint64_t payload_offset; /* from the start of the payload section */
+  uint64_t payload_size;
+  uint64_t conflict_key;
+  int32_t apply_id; /* -1 stands for NULL */
+  int32_t revert_id;
+  int32_t destroy_id;
+  uint32_t flags;
+};
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + FILE_ALIGN - 1) & ~(uint64_t)(FILE_ALIGN - 1);
+}
+
+void rwn_mapping_init(struct FileMapping* mapping) {
+  mapping->addr = NULL;
+  mapping->size = 0;
+}
+
+void rwn_mapping_release(struct FileMapping* mapping) {
+  if (mapping->addr != NULL)
+    munmap(mapping->addr, mapping->size);
+  rwn_mapping_init(mapping);
+}
+
+/*
+ * ID of the function, -1 for NULL; -2 if the codec does not know it
+ */
+static int32_t find_func_id(const void* const* funcs,
+                            int func_count,
+                            const void* func) {
+  if (func == NULL)
+    return -1;
+  int i;
+  for (i = 0; i < func_count; ++i)
+    if (funcs[i] == func)
+      return i;
+  return -2;
+}
+
+static int32_t apply_func_id(const RwnEventCodec* codec,
+                             RwnEventApplyFunc func) {
+  return find_func_id((const void* const*)codec->apply_funcs,
+                      codec->apply_func_count, (const void*)func);
+}
+
+static int32_t destroy_func_id(const RwnEventCodec* codec,
+                               RwnEventDestroyFunc func) {
+  return find_func_id((const void* const*)codec->destroy_funcs,
+                      codec->destroy_func_count, (const void*)func);
+}
+
+static bool write_at(FILE* file,
+                     uint64_t offset,
+                     const void* data,
+                     size_t size) {
+  if (size == 0)
+    return true;
+  return fseek(file, (long)offset, SEEK_SET) == 0 &&
+         fwrite(data, 1, size, file) == size;
+}
+
+/*
+ * Encode all payloads into the payload section and fill the event records
+ */
+static bool write_events(const RwnHistory* h,
+                         struct IndexPos first,
+                         struct IndexPos last,
+                         const RwnEventCodec* codec,
+                         FILE* file,
+                         uint64_t payload_offset,
+                         struct EventRecord* records,
+                         uint64_t* payload_size) {
+  const RwnAllocator* allocator = &h->arena.allocator;
+  size_t buf_size = 256;
+  void* buf = rwn_allocator_alloc(allocator, buf_size);
+  static const char zeros[FILE_ALIGN] = {0};
+  bool ok = fseek(file, (long)payload_offset, SEEK_SET) == 0;
+
+  uint64_t offset = 0;
+  int e = 0;
+  const struct TimepointIndex* index = &h->timepoint_index;
+  struct IndexPos pos;
+  int p, j;
+  for (pos = first; ok && !rwn_index_pos_equal(pos, last);
+       rwn_index_next(index, &pos)) {
+    const struct TimepointHashMapEntry* mapentry = rwn_index_get(index, pos);
+    for (p = 0; ok && p < mapentry->phase_count; ++p) {
+      const struct PhaseBucket* bucket = &mapentry->phases[p];
+      for (j = 0; ok && j < bucket->event_count; ++j, ++e) {
+        const struct EventEntry* evtentry = &bucket->events[j];
+        struct EventRecord* record = &records[e];
+        record->apply_id =
+            apply_func_id(codec, evtentry->user_event_apply_func);
+        record->revert_id =
+            apply_func_id(codec, evtentry->user_event_revert_func);
+        record->destroy_id =
+            destroy_func_id(codec, evtentry->user_event_destroy_func);
+        record->conflict_key = evtentry->conflict_key;
+        record->flags = 0;
+        // async events can not be told apart in the file
+        if (record->apply_id == -2 || record->revert_id == -2 ||
+            record->destroy_id == -2 || evtentry->type == EVENT_TYPE_ASYNC) {
+          ok = false;
+          break;
+        }
+
+        size_t size = 0;
+        if (evtentry->user_event == NULL) {
+          record->flags |= EVENT_RECORD_NULL_EVENT;
+        } else if (codec->encode != NULL) {
+          size = codec->encode(evtentry->user_event, buf, buf_size,
+                               codec->user_data);
+          if (size > buf_size) {
+            rwn_allocator_free(allocator, buf, buf_size);
+            buf_size = size;
+            buf = rwn_allocator_alloc(allocator, buf_size);
+            codec->encode(evtentry->user_event, buf, buf_size,
+                          codec->user_data);
+          }
+        }
+
+        record->payload_offset = offset;
+        record->payload_size = size;
+        // sequential, padded to keep the next payload aligned
+        size_t padding = (size_t)(align_offset(size) - size);
+        ok = fwrite(buf, 1, size, file) == size &&
+             fwrite(zeros, 1, padding, file) == padding;
+        offset += size + padding;
+      }
+    }
+  }
+
+  rwn_allocator_free(allocator, buf, buf_size);
+  *payload_size = offset;
+  return ok;
+}
+
+int rwn_history_save(const RwnHistory* h,
+                     const char* path,
+                     const RwnEventCodec* codec) {
+  return rwn_history_save_range(h, 0, RWN_TIMEPOINT_MAX, path, codec);
+}
+
+int rwn_history_save_range(const RwnHistory* h,
+                           RwnTimepoint start_timepoint,
+                           RwnTimepoint finish_timepoint,
+                           const char* path,
+                           const RwnEventCodec* codec) {
+  const RwnAllocator* allocator = &h->arena.allocator;
+
+  // positions of the populated timepoints of the range
+  const struct TimepointIndex* index = &h->timepoint_index;
+  struct IndexPos first = rwn_timepoints_lower_bound(h, start_timepoint);
+  struct IndexPos last = first;
+  int count = 0;
+  while (!rwn_index_at_end(index, last) &&
+         rwn_index_get(index, last)->timepoint <= finish_timepoint) {
+    rwn_index_next(index, &last);
+    count += 1;
+  }
+
+  struct FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+  header.version = FILE_VERSION;
+  header.byte_order = FILE_BYTE_ORDER;
+  header.timepoint_count = (uint64_t)count;
+
+  struct IndexPos pos;
+  int i, p;
+  for (pos = first; !rwn_index_pos_equal(pos, last);
+       rwn_index_next(index, &pos)) {
+    header.phase_count += (uint64_t)rwn_index_get(index, pos)->phase_count;
+    header.event_count += (uint64_t)rwn_index_get(index, pos)->event_count;
+  }
+
+  header.timepoint_offset = align_offset(sizeof(header));
+  header.phase_offset =
+      align_offset(header.timepoint_offset +
+                   header.timepoint_count * sizeof(struct TimepointRecord));
+  header.event_offset =
+      align_offset(header.phase_offset +
+                   header.phase_count * sizeof(struct PhaseRecord));
+  header.payload_offset =
+      align_offset(header.event_offset +
+                   header.event_count * sizeof(struct EventRecord));
+
+  FILE* file = fopen(path, "wb");
+  if (file == NULL)
+    return -1;
+
+  size_t tp_size = sizeof(struct TimepointRecord) * header.timepoint_count;
+  size_t phase_size = sizeof(struct PhaseRecord) * header.phase_count;
+  size_t event_size = sizeof(struct EventRecord) * header.event_count;
+  struct TimepointRecord* tps = rwn_allocator_alloc(allocator, tp_size);
+  struct PhaseRecord* phases = rwn_allocator_alloc(allocator, phase_size);
+  struct EventRecord* events = rwn_allocator_alloc(allocator, event_size);
+
+  uint64_t phase_index = 0, event_index = 0;
+  for (pos = first, i = 0; i < count; rwn_index_next(index, &pos), ++i) {
+    const struct TimepointHashMapEntry* mapentry = rwn_index_get(index, pos);
+    struct TimepointRecord* tp = &tps[i];
+    tp->timepoint = mapentry->timepoint;
+    tp->phase_count = (uint32_t)mapentry->phase_count;
+    tp->reserved = 0;
+    tp->phase_begin = phase_index;
+    for (p = 0; p < mapentry->phase_count; ++p, ++phase_index) {
+      phases[phase_index].phase = mapentry->phases[p].phase;
+      phases[phase_index].event_count =
+          (uint32_t)mapentry->phases[p].event_count;
+      phases[phase_index].event_begin = event_index;
+      event_index += (uint64_t)mapentry->phases[p].event_count;
+    }
+  }
+
+  // payloads first, as the event records need their offsets
+  bool ok = write_events(h, first, last, codec, file, header.payload_offset,
+                         events, &header.payload_size) &&
+            write_at(file, 0, &header, sizeof(header)) &&
+            write_at(file, header.timepoint_offset, tps, tp_size) &&
+            write_at(file, header.phase_offset, phases, phase_size) &&
+            write_at(file, header.event_offset, events, event_size);
+  if (fclose(file) != 0)
+    ok = false;
+  if (!ok)
+    remove(path);
+
+  rwn_allocator_free(allocator, events, event_size);
+  rwn_allocator_free(allocator, phases, phase_size);
+  rwn_allocator_free(allocator, tps, tp_size);
+
+  return ok ? (int)header.event_count : -1;
+}
+
+/*
+ * The section of `count` records of `size` bytes is within the file
+ */
+static bool section_fits(uint64_t offset,
+                         uint64_t count,
+                         size_t size,
+                         size_t file_size) {
+  return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+static bool check_header(const struct FileHeader* header, size_t file_size) {
+  return memcmp(header->magic, FILE_MAGIC, sizeof(header->magic)) == 0 &&
+         header->version == FILE_VERSION &&
+         header->byte_order == FILE_BYTE_ORDER &&
+         header->event_count <= INT_MAX &&
+         header->timepoint_offset % FILE_ALIGN == 0 &&
+         header->phase_offset % FILE_ALIGN == 0 &&
+         header->event_offset % FILE_ALIGN == 0 &&
+         header->payload_offset % FILE_ALIGN == 0 &&
+         section_fits(header->timepoint_offset, header->timepoint_count,
+                      sizeof(struct TimepointRecord), file_size) &&
+         section_fits(header->phase_offset, header->phase_count,
+                      sizeof(struct PhaseRecord), file_size) &&
+         section_fits(header->event_offset, header->event_count,
+                      sizeof(struct EventRecord), file_size) &&
+         section_fits(header->payload_offset, header->payload_size, 1,
+                      file_size);
+}
+
+static bool func_id_valid(int32_t id, int func_count) {
+  return id >= -1 && id < func_count;
+}
+
+/*
+ * Turn the records into event specs, checking every index on the way
+ */
+static bool read_specs(const char* base,
+                       const struct FileHeader* header,
+                       const RwnEventCodec* codec,
+                       RwnEventSpec* specs) {
+  const struct TimepointRecord* tps =
+      (const void*)(base + header->timepoint_offset);
+  const struct PhaseRecord* phases =
+      (const void*)(base + header->phase_offset);
+  const struct EventRecord* events =
+      (const void*)(base + header->event_offset);
+  const char* payloads = base + header->payload_offset;
+
+  // the records must cover their sections one after another, so that every
+  // spec is written exactly once
+  uint64_t next_phase = 0, next_event = 0;
+  uint64_t i, p, j;
+  for (i = 0; i < header->timepoint_count; ++i) {
+    const struct TimepointRecord* tp = &tps[i];
+    if (tp->timepoint < 0 || tp->timepoint > RWN_TIMEPOINT_MAX ||
+        tp->phase_begin != next_phase ||
+        tp->phase_count > header->phase_count - next_phase)
+      return false;
+    next_phase += tp->phase_count;
+
+    for (p = tp->phase_begin; p < next_phase; ++p) {
+      const struct PhaseRecord* phase = &phases[p];
+      if (phase->event_begin != next_event ||
+          phase->event_count > header->event_count - next_event)
+        return false;
+      next_event += phase->event_count;
+
+      for (j = phase->event_begin; j < next_event; ++j) {
+        const struct EventRecord* record = &events[j];
+        if (!func_id_valid(record->apply_id, codec->apply_func_count) ||
+            !func_id_valid(record->revert_id, codec->apply_func_count) ||
+            !func_id_valid(record->destroy_id, codec->destroy_func_count) ||
+            record->payload_offset > header->payload_size ||
+            record->payload_size >
+                header->payload_size - record->payload_offset)
+          return false;
+
+        RwnEventSpec* spec = &specs[j];
+        spec->timepoint = tp->timepoint;
+        spec->phase = phase->phase;
+        spec->evt_apply_func = record->apply_id < 0
+                                   ? NULL
+                                   : codec->apply_funcs[record->apply_id];
+        spec->evt_revert_func = record->revert_id < 0
+                                    ? NULL
+                                    : codec->apply_funcs[record->revert_id];
+        spec->conflict_key = record->conflict_key;
+
+        const char* payload = payloads + record->payload_offset;
+        if (record->flags & EVENT_RECORD_NULL_EVENT) {
+          spec->evt = NULL;
+          spec->evt_destroy_func = NULL;
+        } else if (codec->decode != NULL) {
+          spec->evt = codec->decode(payload, (size_t)record->payload_size,
+                                    codec->user_data);
+          spec->evt_destroy_func =
+              record->destroy_id < 0
+                  ? NULL
+                  : codec->destroy_funcs[record->destroy_id];
+        } else {
+          spec->evt = payload;
+          spec->evt_destroy_func = NULL;
+        }
+      }
+    }
+  }
+
+  return next_phase == header->phase_count && next_event == header->event_count;
+}
+
+/*
+ * Undo the decoding of an event which did not make it into the history
+ */
+static void destroy_spec(const RwnEventSpec* spec) {
+  if (spec->evt != NULL && spec->evt_destroy_func != NULL)
+    spec->evt_destroy_func((void*)spec->evt);
+}
+
+RwnHistory* rwn_history_load(const char* path,
+                             const RwnEventCodec* codec,
+                             const RwnAllocator* allocator) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct FileHeader)) {
+    close(fd);
+    return NULL;
+  }
+  size_t file_size = (size_t)st.st_size;
+  void* addr = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return NULL;
+
+  const struct FileHeader* header = addr;
+  RwnHistory* h = NULL;
+  if (check_header(header, file_size))
+    h = rwn_history_create_ex(allocator);
+  if (h == NULL) {
+    munmap(addr, file_size);
+    return NULL;
+  }
+
+  int count = (int)header->event_count;
+  size_t specs_size = sizeof(RwnEventSpec) * (size_t)count;
+  RwnEventSpec* specs = rwn_allocator_alloc(&h->arena.allocator, specs_size);
+  memset(specs, 0, specs_size);
+  bool ok = read_specs(addr, header, codec, specs);
+  int i;
+  if (!ok) {
+    // of a partially read file
+    for (i = 0; i < count; ++i)
+      destroy_spec(&specs[i]);
+  } else if (rwn_history_schedule_many_detached(h, specs, count) < count) {
+    // nothing can unschedule the loaded events on its own, so they take no
+    // handles; a fresh history with no window refuses only the retired past
+    RwnTimepoint watermark = rwn_history_watermark(h);
+    for (i = 0; i < count; ++i)
+      if (specs[i].timepoint < watermark)
+        destroy_spec(&specs[i]);
+    ok = false;
+  }
+  rwn_allocator_free(&h->arena.allocator, specs, specs_size);
+
+  if (!ok) {
+    rwn_history_destroy(h);
+    munmap(addr, file_size);
+    return NULL;
+  }
+
+  if (codec->decode == NULL) {
+    h->mapping.addr = addr;
+    h->mapping.size = file_size;
+  } else {
+    munmap(addr, file_size);
+  }
+
+  return h;
+}
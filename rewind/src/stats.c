@@ -0,0 +1,183 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include <rewind/stats.h>
+
+#include "history_private.h"
+
+#include <string.h>
+
+#ifdef RWN_STATS
+
+struct HistoryStats* rwn_stats_create(const RwnAllocator* allocator) {
+  struct HistoryStats* stats = rwn_allocator_alloc(allocator, sizeof(*stats));
+  stats->allocator = *allocator;
+  memset(&stats->totals, 0, sizeof(stats->totals));
+  stats->phases = NULL;
+  stats->phase_count = 0;
+  stats->phase_capacity = 0;
+  stats->funcs = NULL;
+  stats->func_count = 0;
+  stats->func_capacity = 0;
+  return stats;
+}
+
+void rwn_stats_destroy(struct HistoryStats* stats) {
+  RwnAllocator allocator = stats->allocator;
+  rwn_allocator_free(&allocator, stats->phases,
+                     sizeof(*stats->phases) * (size_t)stats->phase_capacity);
+  rwn_allocator_free(&allocator, stats->funcs,
+                     sizeof(*stats->funcs) * (size_t)stats->func_capacity);
+  rwn_allocator_free(&allocator, stats, sizeof(*stats));
+}
+
+void rwn_stats_reset(struct HistoryStats* stats) {
+  memset(&stats->totals, 0, sizeof(stats->totals));
+  stats->phase_count = 0;
+  stats->func_count = 0;
+}
+
+void rwn_stats_record(RwnLatencyHistogram* hist, uint64_t ns) {
+  int bucket = 0;
+  if (ns > 0)
+    bucket = 63 - __builtin_clzll(ns);
+  if (bucket >= RWN_LATENCY_BUCKETS)
+    bucket = RWN_LATENCY_BUCKETS - 1;
+
+  __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hist->total_ns, ns, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Make room for one more element of the table, keeping its contents
+ */
+static void* grow_table(struct HistoryStats* stats,
+                        void* items,
+                        int count,
+                        int* capacity,
+                        size_t elem_size) {
+  if (count < *capacity)
+    return items;
+
+  int new_capacity = *capacity == 0 ? 8 : *capacity * 2;
+  void* new_items =
+      rwn_allocator_alloc(&stats->allocator, elem_size * (size_t)new_capacity);
+  if (count > 0)
+    memcpy(new_items, items, elem_size * (size_t)count);
+  rwn_allocator_free(&stats->allocator, items, elem_size * (size_t)*capacity);
+  *capacity = new_capacity;
+
+  return new_items;
+}
+
+RwnPhaseStats* rwn_stats_phase(struct HistoryStats* stats, int phase) {
+  int lo = 0, hi = stats->phase_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (stats->phases[mid].phase < phase)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < stats->phase_count && stats->phases[lo].phase == phase)
+    return &stats->phases[lo];
+
+  stats->phases = grow_table(stats, stats->phases, stats->phase_count,
+                             &stats->phase_capacity, sizeof(*stats->phases));
+  memmove(&stats->phases[lo + 1], &stats->phases[lo],
+          sizeof(*stats->phases) * (size_t)(stats->phase_count - lo));
+  stats->phase_count += 1;
+
+  RwnPhaseStats* entry = &stats->phases[lo];
+  memset(entry, 0, sizeof(*entry));
+  entry->phase = phase;
+  return entry;
+}
+
+static int lower_bound_func(const struct HistoryStats* stats,
+                            RwnEventApplyFunc func) {
+  int lo = 0, hi = stats->func_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if ((uintptr_t)stats->funcs[mid].func < (uintptr_t)func)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void rwn_stats_add_func(struct HistoryStats* stats, RwnEventApplyFunc func) {
+  int pos = lower_bound_func(stats, func);
+  if (pos < stats->func_count && stats->funcs[pos].func == func)
+    return;
+
+  stats->funcs = grow_table(stats, stats->funcs, stats->func_count,
+                            &stats->func_capacity, sizeof(*stats->funcs));
+  memmove(&stats->funcs[pos + 1], &stats->funcs[pos],
+          sizeof(*stats->funcs) * (size_t)(stats->func_count - pos));
+  stats->func_count += 1;
+
+  RwnApplyFuncStats* entry = &stats->funcs[pos];
+  memset(entry, 0, sizeof(*entry));
+  entry->func = func;
+}
+
+void rwn_stats_record_apply(struct HistoryStats* stats,
+                            RwnPhaseStats* phase_stats,
+                            RwnEventApplyFunc func,
+                            int count,
+                            uint64_t ns) {
+  __atomic_add_fetch(&phase_stats->events_applied, (uint64_t)count,
+                     __ATOMIC_RELAXED);
+  rwn_stats_record(&phase_stats->apply_latency, ns);
+
+  RwnApplyFuncStats* entry = &stats->funcs[lower_bound_func(stats, func)];
+  __atomic_add_fetch(&entry->events_applied, (uint64_t)count,
+                     __ATOMIC_RELAXED);
+  rwn_stats_record(&entry->apply_latency, ns);
+}
+
+#endif /* RWN_STATS */
+
+bool rwn_history_stats(const RwnHistory* h, RwnHistoryStats* stats) {
+#ifdef RWN_STATS
+  *stats = h->stats->totals;
+  stats->phases = h->stats->phases;
+  stats->phase_count = h->stats->phase_count;
+  stats->apply_funcs = h->stats->funcs;
+  stats->apply_func_count = h->stats->func_count;
+  return true;
+#else
+  (void)h;
+  memset(stats, 0, sizeof(*stats));
+  return false;
+#endif
+}
+
+void rwn_history_reset_stats(RwnHistory* h) {
+#ifdef RWN_STATS
+  rwn_stats_reset(h->stats);
+#else
+  (void)h;
+#endif
+}
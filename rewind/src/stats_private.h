@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/allocator.h>
+#include <rewind/stats.h>
+
+#include "clock_private.h"
+
+#include <stdint.h>
+
+/*
+ * Everything below is used only if RWN_STATS is defined; the call sites are
+ * guarded with `#ifdef RWN_STATS` so that a normal build carries no trace of
+ * the instrumentation.
+ */
+
+struct HistoryStats {
+  RwnAllocator allocator;
+  RwnHistoryStats totals; /* the per-phase and per-func tables are below */
+  RwnPhaseStats* phases; /* sorted by phase */
+  int phase_count;
+  int phase_capacity;
+  RwnApplyFuncStats* funcs; /* sorted by function address */
+  int func_count;
+  int func_capacity;
+};
+
+extern struct HistoryStats* rwn_stats_create(const RwnAllocator* allocator);
+
+extern void rwn_stats_destroy(struct HistoryStats* stats);
+
+extern void rwn_stats_reset(struct HistoryStats* stats);
+
+/**
+ * @brief Add a sample to the histogram; safe to call concurrently
+ */
+extern void rwn_stats_record(RwnLatencyHistogram* hist, uint64_t ns);
+
+/**
+ * @brief Find or add the entry of the phase. Not threadsafe: must be called
+ * before the phase is handed to the workers
+ */
+extern RwnPhaseStats* rwn_stats_phase(struct HistoryStats* stats, int phase);
+
+/**
+ * @brief Make sure the function has an entry, so that the workers only need
+ * to look it up. Not threadsafe, same as `rwn_stats_phase()`
+ */
+extern void rwn_stats_add_func(struct HistoryStats* stats,
+                               RwnEventApplyFunc func);
+
+/**
+ * @brief Account one apply call covering `count` events (more than one for a
+ * batch of typed events); safe to call concurrently as long as the function
+ * was added beforehand
+ */
+extern void rwn_stats_record_apply(struct HistoryStats* stats,
+                                   RwnPhaseStats* phase_stats,
+                                   RwnEventApplyFunc func,
+                                   int count,
+                                   uint64_t ns);
@@ -0,0 +1,298 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "timepoint_index.h"
+
+#include "history_private.h"
+
+#include <string.h>
+
+void rwn_index_init(struct TimepointIndex* index,
+                    const RwnAllocator* allocator) {
+  index->allocator = *allocator;
+  index->chunks = NULL;
+  index->chunk_count = 0;
+  index->chunk_capacity = 0;
+  index->count = 0;
+}
+
+static void free_chunks(struct TimepointIndex* index, int first, int last) {
+  if (first == last)
+    return;
+  int c;
+  for (c = first; c < last; ++c)
+    rwn_allocator_free(&index->allocator, index->chunks[c],
+                       sizeof(*index->chunks[c]));
+  memmove(&index->chunks[first], &index->chunks[last],
+          sizeof(*index->chunks) * (size_t)(index->chunk_count - last));
+  index->chunk_count -= last - first;
+}
+
+void rwn_index_release(struct TimepointIndex* index) {
+  free_chunks(index, 0, index->chunk_count);
+  rwn_allocator_free(&index->allocator, index->chunks,
+                     sizeof(*index->chunks) * (size_t)index->chunk_capacity);
+  index->chunks = NULL;
+  index->chunk_capacity = 0;
+  index->count = 0;
+}
+
+/*
+ * Insert an empty chunk before the one at `c`
+ */
+static struct IndexChunk* insert_chunk(struct TimepointIndex* index, int c) {
+  if (index->chunk_count == index->chunk_capacity) {
+    int capacity = index->chunk_capacity < 4 ? 4 : index->chunk_capacity * 2;
+    struct IndexChunk** chunks = rwn_allocator_alloc(
+        &index->allocator, sizeof(*chunks) * (size_t)capacity);
+    if (index->chunk_count > 0)
+      memcpy(chunks, index->chunks,
+             sizeof(*chunks) * (size_t)index->chunk_count);
+    rwn_allocator_free(&index->allocator, index->chunks,
+                       sizeof(*chunks) * (size_t)index->chunk_capacity);
+    index->chunks = chunks;
+    index->chunk_capacity = capacity;
+  }
+
+  memmove(&index->chunks[c + 1], &index->chunks[c],
+          sizeof(*index->chunks) * (size_t)(index->chunk_count - c));
+  struct IndexChunk* chunk =
+      rwn_allocator_alloc(&index->allocator, sizeof(*chunk));
+  chunk->count = 0;
+  index->chunks[c] = chunk;
+  index->chunk_count += 1;
+  return chunk;
+}
+
+/*
+ * Move the upper half of the full chunk at `c` to a new one after it
+ */
+static void split_chunk(struct TimepointIndex* index, int c) {
+  struct IndexChunk* upper = insert_chunk(index, c + 1);
+  struct IndexChunk* lower = index->chunks[c];
+  int half = lower->count / 2;
+  upper->count = lower->count - half;
+  memcpy(upper->entries, &lower->entries[half],
+         sizeof(*upper->entries) * (size_t)upper->count);
+  lower->count = half;
+}
+
+/*
+ * Merge the chunk at `c` with a neighbour if both fit in half a chunk, so that
+ * removals do not leave the index fragmented into nearly empty chunks
+ */
+static void coalesce_chunk(struct TimepointIndex* index, int c) {
+  if (c >= index->chunk_count)
+    c = index->chunk_count - 1;
+  if (c < 0)
+    return;
+  if (c + 1 == index->chunk_count ||
+      index->chunks[c]->count + index->chunks[c + 1]->count >
+          INDEX_CHUNK_SIZE / 2) {
+    c -= 1;
+    if (c < 0 || index->chunks[c]->count + index->chunks[c + 1]->count >
+                     INDEX_CHUNK_SIZE / 2)
+      return;
+  }
+
+  struct IndexChunk* lower = index->chunks[c];
+  const struct IndexChunk* upper = index->chunks[c + 1];
+  memcpy(&lower->entries[lower->count], upper->entries,
+         sizeof(*upper->entries) * (size_t)upper->count);
+  lower->count += upper->count;
+  free_chunks(index, c + 1, c + 2);
+}
+
+static RwnTimepoint chunk_last(const struct IndexChunk* chunk) {
+  return chunk->entries[chunk->count - 1]->timepoint;
+}
+
+/*
+ * The first chunk whose last entry is not less than the timepoint, or
+ * `chunk_count`; chunks are never empty
+ */
+static int find_chunk(const struct TimepointIndex* index,
+                      RwnTimepoint timepoint) {
+  int lo = 0;
+  int hi = index->chunk_count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (chunk_last(index->chunks[mid]) < timepoint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int find_offset(const struct IndexChunk* chunk, RwnTimepoint timepoint) {
+  int lo = 0;
+  int hi = chunk->count;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (chunk->entries[mid]->timepoint < timepoint)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+struct IndexPos rwn_index_begin(const struct TimepointIndex* index) {
+  (void)index;
+  struct IndexPos pos = {0, 0};
+  return pos;
+}
+
+struct IndexPos rwn_index_end(const struct TimepointIndex* index) {
+  struct IndexPos pos;
+  pos.chunk = index->chunk_count;
+  pos.offset = 0;
+  return pos;
+}
+
+bool rwn_index_at_begin(struct IndexPos pos) {
+  return pos.chunk == 0 && pos.offset == 0;
+}
+
+bool rwn_index_at_end(const struct TimepointIndex* index,
+                      struct IndexPos pos) {
+  return pos.chunk == index->chunk_count;
+}
+
+bool rwn_index_pos_equal(struct IndexPos lhs, struct IndexPos rhs) {
+  return lhs.chunk == rhs.chunk && lhs.offset == rhs.offset;
+}
+
+bool rwn_index_pos_valid(const struct TimepointIndex* index,
+                         struct IndexPos pos) {
+  if (pos.chunk < 0 || pos.offset < 0)
+    return false;
+  if (pos.chunk < index->chunk_count)
+    return pos.offset < index->chunks[pos.chunk]->count;
+  return pos.chunk == index->chunk_count && pos.offset == 0;
+}
+
+struct TimepointHashMapEntry* rwn_index_get(const struct TimepointIndex* index,
+                                            struct IndexPos pos) {
+  return index->chunks[pos.chunk]->entries[pos.offset];
+}
+
+void rwn_index_next(const struct TimepointIndex* index, struct IndexPos* pos) {
+  pos->offset += 1;
+  if (pos->offset == index->chunks[pos->chunk]->count) {
+    pos->chunk += 1;
+    pos->offset = 0;
+  }
+}
+
+void rwn_index_prev(const struct TimepointIndex* index, struct IndexPos* pos) {
+  if (pos->offset > 0) {
+    pos->offset -= 1;
+  } else {
+    pos->chunk -= 1;
+    pos->offset = index->chunks[pos->chunk]->count - 1;
+  }
+}
+
+struct IndexPos rwn_index_lower_bound(const struct TimepointIndex* index,
+                                      RwnTimepoint timepoint) {
+  struct IndexPos pos;
+  pos.chunk = find_chunk(index, timepoint);
+  pos.offset = pos.chunk < index->chunk_count
+                   ? find_offset(index->chunks[pos.chunk], timepoint)
+                   : 0;
+  return pos;
+}
+
+struct TimepointHashMapEntry* rwn_index_first(
+    const struct TimepointIndex* index) {
+  return index->chunk_count > 0 ? index->chunks[0]->entries[0] : NULL;
+}
+
+struct TimepointHashMapEntry* rwn_index_last(
+    const struct TimepointIndex* index) {
+  if (index->chunk_count == 0)
+    return NULL;
+  const struct IndexChunk* chunk = index->chunks[index->chunk_count - 1];
+  return chunk->entries[chunk->count - 1];
+}
+
+void rwn_index_insert(struct TimepointIndex* index,
+                      struct TimepointHashMapEntry* entry) {
+  RwnTimepoint timepoint = entry->timepoint;
+  int c = find_chunk(index, timepoint);
+  if (c == index->chunk_count) {
+    // appending, the common case: fill up the last chunk before a new one
+    if (c == 0 || index->chunks[c - 1]->count == INDEX_CHUNK_SIZE)
+      insert_chunk(index, c);
+    else
+      c -= 1;
+  } else if (index->chunks[c]->count == INDEX_CHUNK_SIZE) {
+    split_chunk(index, c);
+    if (chunk_last(index->chunks[c]) < timepoint)
+      c += 1;
+  }
+
+  struct IndexChunk* chunk = index->chunks[c];
+  int offset = find_offset(chunk, timepoint);
+  memmove(&chunk->entries[offset + 1], &chunk->entries[offset],
+          sizeof(*chunk->entries) * (size_t)(chunk->count - offset));
+  chunk->entries[offset] = entry;
+  chunk->count += 1;
+  index->count += 1;
+}
+
+void rwn_index_remove_range(struct TimepointIndex* index,
+                            struct IndexPos first,
+                            struct IndexPos last) {
+  if (rwn_index_pos_equal(first, last))
+    return;
+
+  struct IndexChunk* chunk = index->chunks[first.chunk];
+  if (first.chunk == last.chunk) {
+    memmove(&chunk->entries[first.offset], &chunk->entries[last.offset],
+            sizeof(*chunk->entries) * (size_t)(chunk->count - last.offset));
+    chunk->count -= last.offset - first.offset;
+    index->count -= last.offset - first.offset;
+    coalesce_chunk(index, first.chunk);
+    return;
+  }
+
+  // the tail of the first chunk, the chunks in between, the head of the last
+  index->count -= chunk->count - first.offset;
+  chunk->count = first.offset;
+  int c;
+  for (c = first.chunk + 1; c < last.chunk; ++c)
+    index->count -= index->chunks[c]->count;
+  if (last.chunk < index->chunk_count) {
+    chunk = index->chunks[last.chunk];
+    memmove(&chunk->entries[0], &chunk->entries[last.offset],
+            sizeof(*chunk->entries) * (size_t)(chunk->count - last.offset));
+    chunk->count -= last.offset;
+    index->count -= last.offset;
+  }
+
+  // only the head of the last chunk is sure to be left
+  int drop_from = first.offset > 0 ? first.chunk + 1 : first.chunk;
+  free_chunks(index, drop_from, last.chunk);
+  coalesce_chunk(index, first.chunk);
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#pragma once
+
+#include <rewind/allocator.h>
+#include <rewind/history.h>
+
+#include <stdbool.h>
+
+struct TimepointHashMapEntry;
+
+/*
+ * The populated timepoints in order, partitioned into consecutive ranges of
+ * at most INDEX_CHUNK_SIZE entries each. Inserting or removing anywhere moves
+ * the entries of one chunk only (and the chunk pointers when a chunk is split
+ * or dropped), so scheduling out of order costs the same whatever the size and
+ * sparseness of the history.
+ */
+#define INDEX_CHUNK_SIZE 256
+
+struct IndexChunk {
+  int count;
+  struct TimepointHashMapEntry* entries[INDEX_CHUNK_SIZE];
+};
+
+struct TimepointIndex {
+  RwnAllocator allocator; /* with defaults filled in */
+  struct IndexChunk** chunks;
+  int chunk_count;
+  int chunk_capacity;
+  int count; /* entries in all chunks */
+};
+
+/*
+ * Position of an entry, or the end if `chunk` is `chunk_count`; only valid
+ * until the index is edited
+ */
+struct IndexPos {
+  int chunk;
+  int offset;
+};
+
+extern void rwn_index_init(struct TimepointIndex* index,
+                           const RwnAllocator* allocator);
+
+extern void rwn_index_release(struct TimepointIndex* index);
+
+extern struct IndexPos rwn_index_begin(const struct TimepointIndex* index);
+
+extern struct IndexPos rwn_index_end(const struct TimepointIndex* index);
+
+extern bool rwn_index_at_begin(struct IndexPos pos);
+
+extern bool rwn_index_at_end(const struct TimepointIndex* index,
+                             struct IndexPos pos);
+
+extern bool rwn_index_pos_equal(struct IndexPos lhs, struct IndexPos rhs);
+
+/**
+ * @brief Whether the position still points at an entry (or the end) after the
+ * index was edited; says nothing about which entry that is
+ */
+extern bool rwn_index_pos_valid(const struct TimepointIndex* index,
+                                struct IndexPos pos);
+
+/**
+ * @brief Entry at the position, which must not be the end
+ */
+extern struct TimepointHashMapEntry* rwn_index_get(
+    const struct TimepointIndex* index,
+    struct IndexPos pos);
+
+extern void rwn_index_next(const struct TimepointIndex* index,
+                           struct IndexPos* pos);
+
+/**
+ * @brief Step back; the position must not be the beginning
+ */
+extern void rwn_index_prev(const struct TimepointIndex* index,
+                           struct IndexPos* pos);
+
+/**
+ * @brief Binary search for the position of the first entry not less than the
+ * given timepoint
+ */
+extern struct IndexPos rwn_index_lower_bound(
+    const struct TimepointIndex* index,
+    RwnTimepoint timepoint);
+
+/**
+ * @brief First and last entries, or NULL if the index is empty
+ */
+extern struct TimepointHashMapEntry* rwn_index_first(
+    const struct TimepointIndex* index);
+
+extern struct TimepointHashMapEntry* rwn_index_last(
+    const struct TimepointIndex* index);
+
+/**
+ * @brief Insert the entry of a timepoint which is not in the index yet;
+ * appending after the last one keeps the chunks full
+ */
+extern void rwn_index_insert(struct TimepointIndex* index,
+                             struct TimepointHashMapEntry* entry);
+
+/**
+ * @brief Remove the entries at positions `[first, last)`
+ */
+extern void rwn_index_remove_range(struct TimepointIndex* index,
+                                   struct IndexPos first,
+                                   struct IndexPos last);
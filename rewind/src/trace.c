@@ -0,0 +1,179 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "trace_private.h"
+
+#include "executor_private.h"
+#include "history_private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Written by one worker only, so no atomics: the records of a worker are
+ * read after the batches which wrote them are joined
+ */
+struct TraceRing {
+  RwnTraceRecord* records;
+  uint64_t written; /* in total; the latest `capacity` are kept */
+  char pad[EXECUTOR_CACHE_LINE - sizeof(RwnTraceRecord*) - sizeof(uint64_t)];
+};
+
+struct RwnTrace {
+  int worker_count;
+  int capacity;
+  struct TraceRing* rings;
+  uint64_t dropped; /* records of the workers beyond `worker_count` */
+};
+
+RwnTrace* rwn_trace_create(int worker_count, int capacity) {
+  if (worker_count < 1 || capacity < 1)
+    return NULL;
+
+  RwnTrace* trace = malloc(sizeof(*trace));
+  trace->worker_count = worker_count;
+  trace->capacity = capacity;
+  trace->rings = rwn_cache_line_alloc(sizeof(*trace->rings) *
+                                      (size_t)worker_count);
+  trace->dropped = 0;
+  int w;
+  for (w = 0; w < worker_count; ++w) {
+    trace->rings[w].records =
+        malloc(sizeof(*trace->rings[w].records) * (size_t)capacity);
+    trace->rings[w].written = 0;
+  }
+  return trace;
+}
+
+void rwn_trace_destroy(RwnTrace* trace) {
+  int w;
+  for (w = 0; w < trace->worker_count; ++w)
+    free(trace->rings[w].records);
+  free(trace->rings);
+  free(trace);
+}
+
+void rwn_trace_clear(RwnTrace* trace) {
+  int w;
+  for (w = 0; w < trace->worker_count; ++w)
+    trace->rings[w].written = 0;
+  trace->dropped = 0;
+}
+
+bool rwn_history_set_trace(RwnHistory* h, RwnTrace* trace) {
+#ifdef RWN_NO_TRACE
+  (void)h;
+  (void)trace;
+  return false;
+#else
+  h->trace = trace;
+  return true;
+#endif
+}
+
+void rwn_trace_record(RwnTrace* trace, const RwnTraceRecord* record) {
+  if (record->worker >= trace->worker_count) {
+    __atomic_add_fetch(&trace->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  struct TraceRing* ring = &trace->rings[record->worker];
+  ring->records[ring->written % (uint64_t)trace->capacity] = *record;
+  ring->written += 1;
+}
+
+static int ring_count(const RwnTrace* trace, const struct TraceRing* ring) {
+  return ring->written < (uint64_t)trace->capacity ? (int)ring->written
+                                                    : trace->capacity;
+}
+
+int rwn_trace_count(const RwnTrace* trace) {
+  int count = 0;
+  int w;
+  for (w = 0; w < trace->worker_count; ++w)
+    count += ring_count(trace, &trace->rings[w]);
+  return count;
+}
+
+uint64_t rwn_trace_dropped(const RwnTrace* trace) {
+  uint64_t dropped = trace->dropped;
+  int w;
+  for (w = 0; w < trace->worker_count; ++w)
+    dropped += trace->rings[w].written -
+               (uint64_t)ring_count(trace, &trace->rings[w]);
+  return dropped;
+}
+
+static int cmp_records(const void* lhs, const void* rhs) {
+  const RwnTraceRecord* l = lhs;
+  const RwnTraceRecord* r = rhs;
+  if (l->start_ns != r->start_ns)
+    return l->start_ns < r->start_ns ? -1 : 1;
+  return l->worker < r->worker ? -1 : (l->worker > r->worker);
+}
+
+int rwn_trace_records(const RwnTrace* trace, RwnTraceRecord* records) {
+  int count = 0;
+  int w;
+  for (w = 0; w < trace->worker_count; ++w) {
+    const struct TraceRing* ring = &trace->rings[w];
+    int n = ring_count(trace, ring);
+    uint64_t first = ring->written - (uint64_t)n;
+    int i;
+    for (i = 0; i < n; ++i)
+      records[count++] =
+          ring->records[(first + (uint64_t)i) % (uint64_t)trace->capacity];
+  }
+  qsort(records, (size_t)count, sizeof(*records), cmp_records);
+  return count;
+}
+
+bool rwn_trace_save_chrome(const RwnTrace* trace, const char* path) {
+  int count = rwn_trace_count(trace);
+  RwnTraceRecord* records = malloc(sizeof(*records) * (size_t)(count + 1));
+  count = rwn_trace_records(trace, records);
+
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    free(records);
+    return false;
+  }
+
+  // microseconds since the first record, as the format wants
+  uint64_t origin = count > 0 ? records[0].start_ns : 0;
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  int i;
+  for (i = 0; i < count; ++i) {
+    const RwnTraceRecord* r = &records[i];
+    fprintf(file,
+            "%s\n{\"name\":\"phase %d\",\"cat\":\"rewind\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,"
+            "\"args\":{\"timepoint\":%lld,\"event\":%d,\"count\":%d}}",
+            i > 0 ? "," : "", r->phase, (double)(r->start_ns - origin) / 1e3,
+            (double)(r->end_ns - r->start_ns) / 1e3, r->worker,
+            (long long)r->timepoint, r->event, r->event_count);
+  }
+  fprintf(file, "\n]}\n");
+  free(records);
+
+  bool ok = !ferror(file);
+  return fclose(file) == 0 && ok;
+}
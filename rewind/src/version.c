@@ -0,0 +1,193 @@
+/*
+ * Copyright 2021 Nikolay Burkov <nbrk@linklevel.net>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "history_private.h"
+
+#include <string.h>
+
+struct FrozenTimepoint {
+  struct TimepointHashMapEntry entry; /* pointing into the block */
+  int refs; /* of the versions and the history */
+  RwnAllocator allocator; /* outlives the history */
+};
+
+struct RwnHistoryVersion {
+  RwnAllocator allocator;
+  int type_count;
+  RwnCompletionSource completion_source; /* as set when taken */
+  struct TimepointIndex index; /* of the frozen entries */
+  /* the event types follow */
+};
+
+/*
+ * Bytes up to the payloads, which are aligned like the buckets' ones
+ */
+static size_t frozen_events_end(int phase_count, int event_count) {
+  size_t size = sizeof(struct FrozenTimepoint) +
+                sizeof(struct PhaseBucket) * (size_t)phase_count +
+                sizeof(struct EventEntry) * (size_t)event_count;
+  return (size + 15) & ~(size_t)15;
+}
+
+static size_t frozen_size(const struct TimepointHashMapEntry* entry) {
+  size_t size = frozen_events_end(entry->phase_count, entry->event_count);
+  int i;
+  for (i = 0; i < entry->phase_count; ++i)
+    size += (size_t)entry->phases[i].payload_capacity;
+  return size;
+}
+
+static size_t version_size(int type_count) {
+  return sizeof(RwnHistoryVersion) +
+         sizeof(struct EventTypeEntry) * (size_t)type_count;
+}
+
+static struct EventTypeEntry* version_types(const RwnHistoryVersion* v) {
+  return (struct EventTypeEntry*)(v + 1);
+}
+
+/*
+ * Copy the timepoint into a single block: the entry, its phase buckets, the
+ * events of all phases back to back and then the payloads of typed events
+ */
+static struct FrozenTimepoint* freeze(const RwnHistory* h,
+                                      const struct TimepointHashMapEntry* src) {
+  struct FrozenTimepoint* frozen =
+      rwn_allocator_alloc(&h->arena.allocator, frozen_size(src));
+  frozen->refs = 1;
+  frozen->allocator = h->arena.allocator;
+
+  struct TimepointHashMapEntry* entry = &frozen->entry;
+  *entry = *src;
+  entry->phases = (struct PhaseBucket*)(frozen + 1);
+  entry->phase_capacity = src->phase_count;
+  entry->frozen = NULL;
+
+  struct EventEntry* events =
+      (struct EventEntry*)(entry->phases + src->phase_count);
+  char* payloads = (char*)frozen +
+                   frozen_events_end(src->phase_count, src->event_count);
+  int i, j;
+  for (i = 0; i < src->phase_count; ++i) {
+    const struct PhaseBucket* bucket = &src->phases[i];
+    struct PhaseBucket* copy = &entry->phases[i];
+    *copy = *bucket;
+    copy->event_capacity = bucket->event_count;
+    copy->events = events;
+    copy->payloads = bucket->payload_capacity > 0 ? payloads : NULL;
+    memcpy(events, bucket->events,
+           sizeof(*events) * (size_t)bucket->event_count);
+    if (bucket->payload_bytes > 0)
+      memcpy(payloads, bucket->payloads, (size_t)bucket->payload_bytes);
+    // the payloads keep their offsets
+    for (j = 0; j < bucket->event_count; ++j)
+      if (events[j].type >= 0)
+        events[j].user_event =
+            payloads + ((char*)events[j].user_event - bucket->payloads);
+    events += bucket->event_count;
+    payloads += bucket->payload_capacity;
+  }
+
+  return frozen;
+}
+
+static void release_frozen(struct FrozenTimepoint* frozen) {
+  if (__atomic_sub_fetch(&frozen->refs, 1, __ATOMIC_ACQ_REL) > 0)
+    return;
+
+  RwnAllocator allocator = frozen->allocator;
+  rwn_allocator_free(&allocator, frozen, frozen_size(&frozen->entry));
+}
+
+void rwn_version_thaw(struct TimepointHashMapEntry* mapentry) {
+  if (mapentry->frozen == NULL)
+    return;
+  release_frozen(mapentry->frozen);
+  mapentry->frozen = NULL;
+}
+
+RwnHistoryVersion* rwn_history_version_create(RwnHistory* h) {
+  rwn_history_flush(h);
+
+  RwnHistoryVersion* v = rwn_allocator_alloc(&h->arena.allocator,
+                                              version_size(h->type_count));
+  v->allocator = h->arena.allocator;
+  rwn_index_init(&v->index, &v->allocator);
+  v->type_count = h->type_count;
+  v->completion_source = h->completion_source;
+  if (h->type_count > 0)
+    memcpy(version_types(v), h->types,
+           sizeof(*h->types) * (size_t)h->type_count);
+
+  // appended in order, so that the chunks are full
+  const struct TimepointIndex* index = &h->timepoint_index;
+  struct IndexPos pos;
+  for (pos = rwn_index_begin(index); !rwn_index_at_end(index, pos);
+       rwn_index_next(index, &pos)) {
+    struct TimepointHashMapEntry* mapentry = rwn_index_get(index, pos);
+    // edited since the last version, or never frozen before
+    if (mapentry->frozen == NULL)
+      mapentry->frozen = freeze(h, mapentry);
+    __atomic_add_fetch(&mapentry->frozen->refs, 1, __ATOMIC_RELAXED);
+    rwn_index_insert(&v->index, &mapentry->frozen->entry);
+  }
+
+  return v;
+}
+
+void rwn_history_version_release(RwnHistoryVersion* v) {
+  struct IndexPos pos;
+  for (pos = rwn_index_begin(&v->index); !rwn_index_at_end(&v->index, pos);
+       rwn_index_next(&v->index, &pos)) // the entry comes first in the block
+    release_frozen((struct FrozenTimepoint*)rwn_index_get(&v->index, pos));
+  rwn_index_release(&v->index);
+
+  RwnAllocator allocator = v->allocator;
+  rwn_allocator_free(&allocator, v, version_size(v->type_count));
+}
+
+int rwn_history_version_state_delta(const RwnHistoryVersion* v,
+                                    RwnTimepoint start_timepoint,
+                                    RwnTimepoint finish_timepoint,
+                                    void* state,
+                                    RwnExecutor* executor) {
+  struct Timeline tl;
+  tl.index = &v->index;
+  tl.types = version_types(v);
+  tl.completion_source =
+      v->completion_source.wait != NULL ? &v->completion_source : NULL;
+  tl.trace = NULL; /* a version may be replayed from several threads */
+#ifdef RWN_STATS
+  // the history's counters are not to be touched from other threads
+  tl.stats = NULL;
+#endif
+  return rwn_timeline_state_delta(&tl, start_timepoint, finish_timepoint,
+                                  state, executor);
+}
+
+int rwn_history_version_count_events(const RwnHistoryVersion* v,
+                                     RwnTimepoint at_timepoint) {
+  struct IndexPos pos = rwn_index_lower_bound(&v->index, at_timepoint);
+  if (!rwn_index_at_end(&v->index, pos) &&
+      rwn_index_get(&v->index, pos)->timepoint == at_timepoint)
+    return rwn_index_get(&v->index, pos)->event_count;
+  return 0;
+}
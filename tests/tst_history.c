@@ -20,7 +20,12 @@
  * IN THE SOFTWARE.
  */
 #include <check.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
@@ -97,6 +102,49 @@ START_TEST(create_allocates_memory) {
 }
 END_TEST
 
+struct test_allocator_stats {
+  int allocs;
+  long outstanding_bytes;
+};
+
+void* test_allocator_alloc(size_t size, struct test_allocator_stats* stats) {
+  stats->allocs += 1;
+  stats->outstanding_bytes += (long)size;
+  return malloc(size);
+}
+
+void test_allocator_free(void* ptr,
+                         size_t size,
+                         struct test_allocator_stats* stats) {
+  stats->outstanding_bytes -= (long)size;
+  free(ptr);
+}
+
+START_TEST(create_ex_takes_memory_from_allocator) {
+  struct test_allocator_stats stats = {0, 0};
+  RwnAllocator allocator;
+  allocator.alloc = (void* (*)(size_t, void*))test_allocator_alloc;
+  allocator.realloc = NULL;
+  allocator.free = (void (*)(void*, size_t, void*))test_allocator_free;
+  allocator.user_data = &stats;
+
+  RwnHistory* h = rwn_history_create_ex(&allocator);
+  ck_assert_ptr_nonnull(h);
+
+  const int NEVENTS = 10000;
+  int i;
+  for (i = 0; i < NEVENTS; ++i)
+    rwn_history_schedule(h, i % 1000, i % 3, &stats, NULL, NULL);
+  ck_assert_int_eq(rwn_history_count_events(h, 999), 10);
+
+  // nodes are packed into blocks
+  ck_assert_int_lt(stats.allocs, NEVENTS / 10);
+
+  rwn_history_destroy(h);
+  ck_assert_int_eq(stats.outstanding_bytes, 0);
+}
+END_TEST
+
 START_TEST(destroy_deallocates_memory) {
   RwnHistory* h = (RwnHistory*)0xdeadbeef;
 
@@ -157,6 +205,45 @@ START_TEST(events_added_and_removed_from_scheduler) {
 }
 END_TEST
 
+START_TEST(unschedule_keeps_other_handles_valid) {
+  RwnHistory* h = rwn_history_create();
+
+  int ev[100];
+  RwnEventHandle* eh[100];
+  int i;
+  for (i = 0; i < 100; ++i) {
+    ev[i] = i;
+    eh[i] = rwn_history_schedule(h, 5, i % 2, &ev[i], NULL, NULL);
+  }
+
+  // unschedule every third in reverse, shuffling the rest around
+  for (i = 99; i >= 0; i -= 3)
+    rwn_history_unschedule(h, eh[i]);
+  ck_assert_int_eq(rwn_history_count_events(h, 5), 66);
+
+  int* retev[100];
+  int seen[100] = {0};
+  ck_assert_int_eq(rwn_history_get_events(h, 5, (void**)retev), 66);
+  for (i = 0; i < 66; ++i)
+    seen[*retev[i]] += 1;
+  for (i = 0; i < 100; ++i)
+    ck_assert_int_eq(seen[i], (99 - i) % 3 == 0 ? 0 : 1);
+
+  // freed slots get reused, but never with an equal handle
+  RwnEventHandle* reused = rwn_history_schedule(h, 5, 0, &ev[0], NULL, NULL);
+  for (i = 99; i >= 0; i -= 3)
+    ck_assert_ptr_ne(reused, eh[i]);
+  rwn_history_unschedule(h, reused);
+
+  for (i = 0; i < 100; ++i)
+    if ((99 - i) % 3 != 0)
+      rwn_history_unschedule(h, eh[i]);
+  ck_assert_int_eq(rwn_history_count_events(h, 5), 0);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
 START_TEST(unschedule_destroys_events_with_callback) {
   RwnHistory* h = rwn_history_create();
 
@@ -238,6 +325,44 @@ START_TEST(state_delta_after_events) {
 }
 END_TEST
 
+START_TEST(state_delta_visits_sparse_timepoints_in_order) {
+  RwnHistory* h = rwn_history_create();
+  struct test_state* state = malloc(sizeof(*state));
+  state->value = 1;
+
+  struct test_event_incr* e_incr = malloc(sizeof(*e_incr));
+  e_incr->amount = 1;
+  struct test_event_mult* e_mult = malloc(sizeof(*e_mult));
+  e_mult->by = 10;
+
+  // scheduled out of order: (1 + 1) * 10 + 1
+  rwn_history_schedule(h, 2000000000, 0, e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 10, 0, e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 5000000, 0, e_mult,
+                       (RwnEventApplyFunc)test_event_mult_apply, NULL);
+
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 0), 10);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 10), 10);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 11), 5000000);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 5000001), 2000000000);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 2000000001), -1);
+
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 2147483647, state, 0), 3);
+  ck_assert_int_eq(state->value, 21);
+
+  ck_assert_int_eq(rwn_history_unschedule_all(h, 11, 2000000000), 2);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 11), -1);
+  ck_assert_int_eq(rwn_history_count_events(h, 10), 1);
+
+  rwn_history_destroy(h);
+  free(e_incr);
+  free(e_mult);
+  free(state);
+}
+END_TEST
+
 START_TEST(scheduled_event_count_and_ptrs_returned) {
   RwnHistory* h = rwn_history_create();
 
@@ -260,6 +385,136 @@ START_TEST(scheduled_event_count_and_ptrs_returned) {
 }
 END_TEST
 
+struct test_visit_log {
+  int count;
+  int limit;
+  int timepoints[16];
+  int phases[16];
+  const void* evts[16];
+  RwnEventHandle* handles[16];
+};
+
+bool test_visit_log_event(const RwnEventInfo* info,
+                          struct test_visit_log* log) {
+  log->timepoints[log->count] = info->timepoint;
+  log->phases[log->count] = info->phase;
+  log->evts[log->count] = info->evt;
+  log->handles[log->count] = info->handle;
+  log->count += 1;
+  return log->count < log->limit;
+}
+
+START_TEST(visit_events_in_timepoint_and_phase_order) {
+  RwnHistory* h = rwn_history_create();
+
+  int ev[4] = {0, 1, 2, 3};
+  rwn_history_schedule(h, 20, 0, &ev[0], NULL, NULL);
+  rwn_history_schedule(h, 10, 5, &ev[1], NULL, NULL);
+  rwn_history_schedule(h, 10, 1, &ev[2], NULL, NULL);
+  RwnEventHandle* eh = rwn_history_schedule(h, 30, 0, &ev[3], NULL, NULL);
+
+  struct test_visit_log log;
+  log.count = 0;
+  log.limit = 16;
+  ck_assert_int_eq(rwn_history_visit_events(
+                       h, 0, 25, (RwnEventVisitFunc)test_visit_log_event, &log),
+                   3);
+  ck_assert_int_eq(log.timepoints[0], 10);
+  ck_assert_int_eq(log.phases[0], 1);
+  ck_assert_ptr_eq(log.evts[0], &ev[2]);
+  ck_assert_int_eq(log.timepoints[1], 10);
+  ck_assert_int_eq(log.phases[1], 5);
+  ck_assert_ptr_eq(log.evts[1], &ev[1]);
+  ck_assert_int_eq(log.timepoints[2], 20);
+  ck_assert_ptr_eq(log.evts[2], &ev[0]);
+
+  // stopped by the visitor
+  log.count = 0;
+  log.limit = 2;
+  ck_assert_int_eq(rwn_history_visit_events(
+                       h, 0, 100, (RwnEventVisitFunc)test_visit_log_event,
+                       &log),
+                   2);
+
+  // handles reported are the issued ones
+  log.count = 0;
+  log.limit = 16;
+  rwn_history_visit_events(h, 30, 30, (RwnEventVisitFunc)test_visit_log_event,
+                           &log);
+  ck_assert_ptr_eq(log.handles[0], eh);
+
+  log.count = 0;
+  rwn_history_unschedule(h, eh);
+  ck_assert_int_eq(rwn_history_visit_events(
+                       h, 30, 30, (RwnEventVisitFunc)test_visit_log_event,
+                       &log),
+                   0);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+static int test_destroyed_count = 0;
+
+static void test_count_destroy(void* e) {
+  (void)e;
+  test_destroyed_count += 1;
+}
+
+START_TEST(detached_events_take_no_handles) {
+  RwnHistory* h = rwn_history_create();
+  test_destroyed_count = 0;
+
+  struct test_event_incr incr[4] = {{1}, {2}, {4}, {8}};
+  RwnEventHandle* eh = rwn_history_schedule(
+      h, 10, 0, &incr[0], (RwnEventApplyFunc)test_event_incr_apply,
+      test_count_destroy);
+  ck_assert(rwn_history_schedule_detached(
+      h, 10, 0, &incr[1], (RwnEventApplyFunc)test_event_incr_apply,
+      test_count_destroy));
+  RwnEventSpec specs[2];
+  int i;
+  for (i = 0; i < 2; ++i) {
+    specs[i].timepoint = 20 + i;
+    specs[i].phase = 0;
+    specs[i].evt = &incr[2 + i];
+    specs[i].evt_apply_func = (RwnEventApplyFunc)test_event_incr_apply;
+    specs[i].evt_destroy_func = test_count_destroy;
+    specs[i].evt_revert_func = NULL;
+    specs[i].conflict_key = 0;
+  }
+  ck_assert_int_eq(rwn_history_schedule_many_detached(h, specs, 2), 2);
+
+  struct test_state state = {0};
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 30, &state, 1), 4);
+  ck_assert_float_eq(state.value, 15.0f);
+
+  // the detached event takes the place of the unscheduled one
+  rwn_history_unschedule(h, eh);
+  ck_assert_int_eq(test_destroyed_count, 1);
+  struct test_visit_log log;
+  log.count = 0;
+  log.limit = 16;
+  ck_assert_int_eq(rwn_history_visit_events(
+                       h, 0, 30, (RwnEventVisitFunc)test_visit_log_event, &log),
+                   3);
+  for (i = 0; i < 3; ++i)
+    ck_assert_ptr_eq(log.handles[i], NULL);
+  ck_assert_ptr_eq(log.evts[0], &incr[1]);
+
+  // unscheduled with their timepoints
+  ck_assert_int_eq(rwn_history_unschedule_all(h, 0, 20), 2);
+  ck_assert_int_eq(test_destroyed_count, 3);
+
+  ck_assert_int_eq(rwn_history_retire(h, 25), 1);
+  ck_assert_int_eq(test_destroyed_count, 4);
+  ck_assert(!rwn_history_schedule_detached(
+      h, 24, 0, &incr[0], (RwnEventApplyFunc)test_event_incr_apply, NULL));
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
 START_TEST(unschedule_all_destroys_events) {
   RwnHistory* h = rwn_history_create();
 
@@ -285,6 +540,262 @@ START_TEST(unschedule_all_destroys_events) {
 }
 END_TEST
 
+START_TEST(events_grouped_by_phase_in_scheduling_order) {
+  RwnHistory* h = rwn_history_create();
+
+  const int NEVENTS = 1000;
+  int* ev = malloc(sizeof(*ev) * NEVENTS);
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    ev[i] = i;
+    rwn_history_schedule(h, 7, (i * 7) % 5, &ev[i], NULL, NULL);
+  }
+
+  int** retev = malloc(sizeof(*retev) * NEVENTS);
+  ck_assert_int_eq(rwn_history_get_events(h, 7, (void**)retev), NEVENTS);
+  for (i = 1; i < NEVENTS; ++i) {
+    int prev_phase = (*retev[i - 1] * 7) % 5;
+    int phase = (*retev[i] * 7) % 5;
+    ck_assert_int_le(prev_phase, phase);
+    if (prev_phase == phase)
+      ck_assert_int_lt(*retev[i - 1], *retev[i]);
+  }
+
+  rwn_history_destroy(h);
+  free(retev);
+  free(ev);
+}
+END_TEST
+
+START_TEST(unschedule_all_truncates_future_keeping_past) {
+  RwnHistory* h = rwn_history_create();
+
+  struct test_event_alive ev[1000];
+  RwnEventHandle* eh[1000];
+  int i;
+  for (i = 0; i < 1000; ++i) {
+    ev[i].alive = true;
+    eh[i] = rwn_history_schedule(
+        h, i / 2, i % 3, &ev[i], NULL,
+        (RwnEventDestroyFunc)test_event_alive_destroy);
+  }
+
+  ck_assert_int_eq(rwn_history_unschedule_all(h, 250, 2147483647), 500);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 250), -1);
+  ck_assert_int_eq(rwn_history_count_events(h, 249), 2);
+
+  for (i = 0; i < 1000; ++i)
+    ck_assert(ev[i].alive == (i < 500));
+
+  // handles of the past are still good
+  for (i = 0; i < 500; ++i)
+    rwn_history_unschedule(h, eh[i]);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 0), -1);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(schedule_many_same_as_one_by_one) {
+  RwnHistory* h_one = rwn_history_create();
+  RwnHistory* h_many = rwn_history_create();
+
+  // some timepoints exist already
+  int ev_pre = -1;
+  rwn_history_schedule(h_one, 50, 0, &ev_pre, NULL, NULL);
+  rwn_history_schedule(h_many, 50, 0, &ev_pre, NULL, NULL);
+
+  const int NEVENTS = 3000;
+  int* ev = malloc(sizeof(*ev) * NEVENTS);
+  RwnEventSpec* specs = malloc(sizeof(*specs) * NEVENTS);
+  RwnEventHandle** handles = malloc(sizeof(*handles) * NEVENTS);
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    ev[i] = i;
+    specs[i].timepoint = (i % 7 == 0) ? -1 : (i * 37) % 101;
+    specs[i].phase = i % 4;
+    specs[i].evt = &ev[i];
+    specs[i].evt_apply_func = NULL;
+    specs[i].evt_destroy_func = NULL;
+    specs[i].evt_revert_func = NULL;
+    specs[i].conflict_key = 0;
+    rwn_history_schedule(h_one, specs[i].timepoint, specs[i].phase, &ev[i],
+                         NULL, NULL);
+  }
+  int scheduled = rwn_history_schedule_many(h_many, specs, NEVENTS, handles);
+  ck_assert_int_eq(scheduled, NEVENTS - (NEVENTS + 6) / 7);
+
+  int** retev_one = malloc(sizeof(*retev_one) * (NEVENTS + 1));
+  int** retev_many = malloc(sizeof(*retev_many) * (NEVENTS + 1));
+  int tp;
+  for (tp = 0; tp <= 101; ++tp) {
+    int count = rwn_history_get_events(h_one, tp, (void**)retev_one);
+    ck_assert_int_eq(rwn_history_get_events(h_many, tp, (void**)retev_many),
+                     count);
+    for (i = 0; i < count; ++i)
+      ck_assert_ptr_eq(retev_one[i], retev_many[i]);
+  }
+
+  for (i = 0; i < NEVENTS; ++i) {
+    if (specs[i].timepoint < 0) {
+      ck_assert_ptr_null(handles[i]);
+    } else {
+      ck_assert_ptr_nonnull(handles[i]);
+      rwn_history_unschedule(h_many, handles[i]);
+    }
+  }
+  ck_assert_int_eq(rwn_history_next_timepoint(h_many, 0), 50);
+  ck_assert_int_eq(rwn_history_next_timepoint(h_many, 51), -1);
+
+  rwn_history_destroy(h_one);
+  rwn_history_destroy(h_many);
+  free(retev_many);
+  free(retev_one);
+  free(handles);
+  free(specs);
+  free(ev);
+}
+END_TEST
+
+#define NPRODUCERS 4
+#define NPOSTS 1000
+
+struct Producer {
+  RwnHistory* h;
+  struct test_event_incr ev[NPOSTS];
+};
+
+static void* producer_thread(void* arg) {
+  struct Producer* p = arg;
+  int i;
+  for (i = 0; i < NPOSTS; ++i) {
+    RwnEventSpec spec;
+    spec.timepoint = i % 10;
+    spec.phase = 0;
+    spec.evt = &p->ev[i];
+    spec.evt_apply_func = (RwnEventApplyFunc)test_event_incr_apply;
+    spec.evt_destroy_func = NULL;
+    spec.evt_revert_func = NULL;
+    spec.conflict_key = 0;
+    rwn_history_post(p->h, &spec, 1);
+  }
+  return NULL;
+}
+
+START_TEST(posted_events_scheduled_on_flush) {
+  RwnHistory* h = rwn_history_create();
+  struct Producer producers[NPRODUCERS];
+  pthread_t threads[NPRODUCERS];
+  int i, j;
+  for (i = 0; i < NPRODUCERS; ++i) {
+    producers[i].h = h;
+    for (j = 0; j < NPOSTS; ++j)
+      producers[i].ev[j].amount = i * NPOSTS + j;
+    pthread_create(&threads[i], NULL, producer_thread, &producers[i]);
+  }
+  for (i = 0; i < NPRODUCERS; ++i)
+    pthread_join(threads[i], NULL);
+
+  // nothing is scheduled until the owner flushes
+  ck_assert_int_eq(rwn_history_count_events(h, 0), 0);
+  ck_assert_int_eq(rwn_history_flush(h), NPRODUCERS * NPOSTS);
+  ck_assert_int_eq(rwn_history_flush(h), 0);
+
+  struct test_state state = {0};
+  rwn_history_state_delta(h, 0, 9, &state, 1);
+  ck_assert_float_eq(state.value, (float)(NPRODUCERS * NPOSTS) *
+                                      (NPRODUCERS * NPOSTS - 1) / 2);
+
+  // the events of each producer keep their order within the timepoint
+  struct test_event_incr* retev[NPRODUCERS * NPOSTS / 10];
+  int tp;
+  for (tp = 0; tp < 10; ++tp) {
+    int count = rwn_history_get_events(h, tp, (void**)retev);
+    ck_assert_int_eq(count, NPRODUCERS * NPOSTS / 10);
+    int last[NPRODUCERS];
+    for (i = 0; i < NPRODUCERS; ++i)
+      last[i] = -1;
+    for (j = 0; j < count; ++j) {
+      int amount = retev[j]->amount;
+      ck_assert_int_lt(last[amount / NPOSTS], amount);
+      last[amount / NPOSTS] = amount;
+    }
+  }
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+#define NREADERS 4
+
+struct VersionReader {
+  const RwnHistoryVersion* v;
+  float value;
+};
+
+static void* version_reader_thread(void* arg) {
+  struct VersionReader* r = arg;
+  int i;
+  for (i = 0; i < 100; ++i) {
+    struct test_state state = {0};
+    rwn_history_version_state_delta(r->v, 0, 99, &state, NULL);
+    if (i > 0 && state.value != r->value)
+      break;
+    r->value = state.value;
+  }
+  return NULL;
+}
+
+START_TEST(version_replays_while_history_is_edited) {
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr ev = {1};
+  int tp;
+  for (tp = 0; tp < 100; ++tp)
+    rwn_history_schedule(h, tp, 0, &ev,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  RwnHistoryVersion* v1 = rwn_history_version_create(h);
+  struct VersionReader readers[NREADERS];
+  pthread_t threads[NREADERS];
+  int i;
+  for (i = 0; i < NREADERS; ++i) {
+    readers[i].v = v1;
+    readers[i].value = -1;
+    pthread_create(&threads[i], NULL, version_reader_thread, &readers[i]);
+  }
+
+  // the owner goes on meanwhile
+  RwnEventHandle* eh = NULL;
+  for (tp = 0; tp < 100; ++tp)
+    eh = rwn_history_schedule(h, tp, 1, &ev,
+                              (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_unschedule(h, eh);
+
+  for (i = 0; i < NREADERS; ++i) {
+    pthread_join(threads[i], NULL);
+    ck_assert_float_eq(readers[i].value, 100);
+  }
+  ck_assert_int_eq(rwn_history_version_count_events(v1, 99), 1);
+
+  // the next version sees the edits, the old one still does not
+  RwnHistoryVersion* v2 = rwn_history_version_create(h);
+  struct test_state state = {0};
+  ck_assert_int_eq(rwn_history_version_state_delta(v2, 0, 99, &state, NULL),
+                   199);
+  ck_assert_float_eq(state.value, 199);
+  ck_assert_int_eq(rwn_history_version_count_events(v2, 99), 1);
+  ck_assert_int_eq(rwn_history_version_count_events(v2, 98), 2);
+  rwn_history_version_release(v1);
+
+  // versions outlive the history
+  rwn_history_destroy(h);
+  state.value = 0;
+  rwn_history_version_state_delta(v2, 50, 99, &state, NULL);
+  ck_assert_float_eq(state.value, 99);
+  rwn_history_version_release(v2);
+}
+END_TEST
+
 START_TEST(scheduled_events_applied_by_phases) {
   RwnHistory* h = rwn_history_create();
   struct test_state* state = malloc(sizeof(*state));
@@ -362,6 +873,1423 @@ START_TEST(state_delta_after_events_with_multithreaded_phases) {
 }
 END_TEST
 
+START_TEST(state_delta_ex_reuses_executor_across_calls) {
+  struct test_state_mt* state = malloc(sizeof(*state));
+  state->value = 0;
+  pthread_mutex_init(&state->mutex, NULL);
+
+  RwnHistory* h = rwn_history_create();
+  RwnExecutor* ex = rwn_executor_create(4);
+  ck_assert_int_eq(rwn_executor_num_threads(ex), 4);
+
+  int i;
+  for (i = 0; i < 100; ++i) {
+    struct test_event_incr_mt* e = malloc(sizeof(*e));
+    e->amount = 1;
+    rwn_history_schedule(h, i % 10, i % 3, e,
+                         (RwnEventApplyFunc)test_event_incr_apply_mt, free);
+  }
+
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 9, state, ex), 100);
+  ck_assert_int_eq(state->value, 100);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 4, state, ex), 50);
+  ck_assert_int_eq(state->value, 150);
+
+  rwn_executor_destroy(ex);
+  rwn_history_destroy(h);
+
+  free(state);
+}
+END_TEST
+
+struct test_shard_stats {
+  int forks;
+  int discards;
+};
+
+struct test_state* test_shard_fork(const struct test_state* state,
+                                   struct test_shard_stats* stats) {
+  struct test_state* shard = malloc(sizeof(*shard));
+  shard->value = 0;
+  stats->forks += 1;
+  return shard;
+}
+
+void test_shard_merge(struct test_state* state,
+                      struct test_state* shard,
+                      struct test_shard_stats* stats) {
+  state->value += shard->value;
+  shard->value = 0;
+}
+
+void test_shard_discard(struct test_state* shard,
+                        struct test_shard_stats* stats) {
+  stats->discards += 1;
+  free(shard);
+}
+
+START_TEST(state_delta_sharded_merges_shards_at_phase_end) {
+  struct test_state state;
+  state.value = 0;
+
+  struct test_shard_stats stats = {0, 0};
+  RwnStateShardFuncs funcs;
+  funcs.fork_state = (void* (*)(const void*, void*))test_shard_fork;
+  funcs.merge_state = (void (*)(void*, void*, void*))test_shard_merge;
+  funcs.discard_state = (void (*)(void*, void*))test_shard_discard;
+  funcs.user_data = &stats;
+
+  RwnHistory* h = rwn_history_create();
+  RwnExecutor* ex = rwn_executor_create(4);
+
+  // no locking in the apply function: every thread has its own shard
+  struct test_event_incr e = {1};
+  int i;
+  for (i = 0; i < 1000; ++i)
+    rwn_history_schedule(h, i % 5, i % 2, &e,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  ck_assert_int_eq(
+      rwn_history_state_delta_sharded(h, 0, 4, &state, ex, &funcs), 1000);
+  ck_assert_int_eq(state.value, 1000);
+  ck_assert_int_eq(stats.forks, 4);
+  ck_assert_int_eq(stats.discards, 4);
+
+  // nothing to apply, nothing to fork
+  ck_assert_int_eq(
+      rwn_history_state_delta_sharded(h, 10, 20, &state, ex, &funcs), 0);
+  ck_assert_int_eq(stats.forks, 4);
+
+  rwn_executor_destroy(ex);
+  rwn_history_destroy(h);
+}
+END_TEST
+
+void test_event_incr_revert(const struct test_event_incr* e,
+                            struct test_state* s) {
+  s->value -= (float)e->amount;
+}
+
+void test_event_mult_revert(const struct test_event_mult* e,
+                            struct test_state* s) {
+  s->value /= (float)e->by;
+}
+
+START_TEST(state_delta_backwards_reverts_events) {
+  RwnHistory* h = rwn_history_create();
+  struct test_state state;
+
+  struct test_event_incr e_incr = {3};
+  struct test_event_mult e_mult = {2};
+  rwn_history_schedule_reversible(h, 2, 1, &e_incr,
+                                  (RwnEventApplyFunc)test_event_incr_apply,
+                                  (RwnEventApplyFunc)test_event_incr_revert,
+                                  NULL);
+  rwn_history_schedule_reversible(h, 2, 0, &e_mult,
+                                  (RwnEventApplyFunc)test_event_mult_apply,
+                                  (RwnEventApplyFunc)test_event_mult_revert,
+                                  NULL);
+  rwn_history_schedule_reversible(h, 5, 0, &e_mult,
+                                  (RwnEventApplyFunc)test_event_mult_apply,
+                                  (RwnEventApplyFunc)test_event_mult_revert,
+                                  NULL);
+
+  // ((1 * 2) + 3) * 2
+  state.value = 1;
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 9, &state, 0), 3);
+  ck_assert_int_eq(state.value, 10);
+
+  // undo the last timepoint only, then everything else
+  ck_assert_int_eq(rwn_history_state_delta(h, 9, 3, &state, 0), 1);
+  ck_assert_int_eq(state.value, 5);
+  ck_assert_int_eq(rwn_history_state_delta(h, 2, 0, &state, 0), 2);
+  ck_assert_int_eq(state.value, 1);
+
+  // an irreversible event makes its range refuse to revert
+  struct test_event_incr e_plain = {1};
+  rwn_history_schedule(h, 4, 0, &e_plain,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  state.value = 10;
+  ck_assert_int_eq(rwn_history_state_delta(h, 9, 0, &state, 0), -1);
+  ck_assert_int_eq(state.value, 10);
+  ck_assert_int_eq(rwn_history_state_delta(h, 9, 5, &state, 0), 1);
+  ck_assert_int_eq(state.value, 5);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+struct test_state_keyed {
+  long slots[4];
+  long total;
+};
+
+struct test_event_keyed {
+  int slot;
+  int timepoint;
+};
+
+void test_event_keyed_apply(const struct test_event_keyed* e,
+                            struct test_state_keyed* s) {
+  // order dependent: every slot would differ if reordered
+  s->slots[e->slot] = s->slots[e->slot] * 2 + e->timepoint;
+}
+
+void test_event_keyed_sum(const void* e, struct test_state_keyed* s) {
+  int i;
+  for (i = 0; i < 4; ++i)
+    s->total += s->slots[i];
+}
+
+START_TEST(state_delta_multi_same_as_one_by_one) {
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {3};
+  struct test_event_mult mult = {2};
+  int tp;
+  for (tp = 0; tp < 3000; ++tp) {
+    // several segments, and an order which matters
+    rwn_history_schedule(h, tp, 0, &incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+    if (tp % 100 == 0)
+      rwn_history_schedule(h, tp, 1, &mult,
+                           (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  }
+
+  const int NSTATES = 64;
+  struct test_state expected[64];
+  struct test_state states[64];
+  void* state_ptrs[64];
+  int i;
+  for (i = 0; i < NSTATES; ++i) {
+    expected[i].value = (float)i;
+    states[i].value = (float)i;
+    state_ptrs[i] = &states[i];
+    rwn_history_state_delta(h, 10, 2500, &expected[i], 0);
+  }
+
+  RwnExecutor* ex = rwn_executor_create(4);
+  ck_assert_int_eq(
+      rwn_history_state_delta_multi(h, 10, 2500, state_ptrs, NSTATES, ex),
+      2491 + 25);
+  for (i = 0; i < NSTATES; ++i)
+    ck_assert_float_eq(states[i].value, expected[i].value);
+
+  // the same without executor; backwards is refused as a whole
+  for (i = 0; i < NSTATES; ++i)
+    states[i].value = (float)i;
+  ck_assert_int_eq(
+      rwn_history_state_delta_multi(h, 10, 2500, state_ptrs, NSTATES, NULL),
+      2491 + 25);
+  ck_assert_float_eq(states[NSTATES - 1].value, expected[NSTATES - 1].value);
+  ck_assert_int_eq(
+      rwn_history_state_delta_multi(h, 2500, 10, state_ptrs, NSTATES, ex), -1);
+  ck_assert_float_eq(states[NSTATES - 1].value, expected[NSTATES - 1].value);
+  rwn_executor_destroy(ex);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+static bool stop_above_hundred(RwnTimepoint timepoint,
+                               void* state,
+                               void* user_data) {
+  (void)timepoint;
+  (void)user_data;
+  return ((struct test_state*)state)->value <= 100.0f;
+}
+
+static bool stop_after_phase_zero(RwnTimepoint timepoint,
+                                  int phase,
+                                  void* state,
+                                  void* user_data) {
+  (void)timepoint;
+  (void)state;
+  (void)user_data;
+  return phase != 0;
+}
+
+START_TEST(state_delta_until_stops_where_condition_holds) {
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {3};
+  struct test_event_mult mult = {2};
+  int tp;
+  for (tp = 0; tp < 100; ++tp) {
+    rwn_history_schedule(h, tp * 2, 0, &incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+    rwn_history_schedule(h, tp * 2, 1, &mult,
+                         (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  }
+
+  // 0 -> 6 -> 18 -> 42 -> 90 -> 186
+  RwnStepFuncs funcs = {stop_above_hundred, NULL, NULL};
+  struct test_state s = {0.0f};
+  RwnTimepoint stopped;
+  ck_assert_int_eq(
+      rwn_history_state_delta_until(h, 0, 199, &s, NULL, &funcs, &stopped), 10);
+  ck_assert_int_eq(stopped, 8);
+  ck_assert_float_eq(s.value, 186.0f);
+
+  // not stopped within the range
+  s.value = 0.0f;
+  ck_assert_int_eq(
+      rwn_history_state_delta_until(h, 0, 6, &s, NULL, &funcs, &stopped), 8);
+  ck_assert_int_eq(stopped, -1);
+  ck_assert_float_eq(s.value, 90.0f);
+
+  // stopped in the middle of a timepoint
+  funcs.after_timepoint = NULL;
+  funcs.after_phase = stop_after_phase_zero;
+  s.value = 0.0f;
+  ck_assert_int_eq(
+      rwn_history_state_delta_until(h, 1, 199, &s, NULL, &funcs, &stopped), 1);
+  ck_assert_int_eq(stopped, 2);
+  ck_assert_float_eq(s.value, 3.0f);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(cursor_steps_and_resumes_after_edits) {
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {3};
+  struct test_event_mult mult = {2};
+  int tp;
+  for (tp = 0; tp < 10; ++tp) {
+    rwn_history_schedule(h, tp * 10, 0, &incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+    rwn_history_schedule(h, tp * 10, 1, &mult,
+                         (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  }
+
+  RwnHistoryCursor* c = rwn_history_cursor_create(h, 5);
+  struct test_state s = {0.0f};
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 2);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 11);
+  ck_assert_float_eq(s.value, 6.0f);
+
+  // stop after the first phase, then finish the timepoint
+  RwnStepFuncs funcs = {NULL, stop_after_phase_zero, NULL};
+  ck_assert_int_eq(rwn_history_cursor_run(c, 99, &s, NULL, &funcs), 1);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 20);
+  ck_assert_float_eq(s.value, 9.0f);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 1);
+  ck_assert_float_eq(s.value, 18.0f);
+
+  // edits behind the cursor are not applied, the ones ahead are
+  rwn_history_schedule(h, 15, 0, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 25, 0, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  ck_assert_int_eq(rwn_history_cursor_run(c, 30, &s, NULL, NULL), 3);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 31);
+  ck_assert_float_eq(s.value, 48.0f);
+
+  // an empty range moves the cursor all the same
+  ck_assert_int_eq(rwn_history_cursor_run(c, 35, &s, NULL, NULL), 0);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 36);
+
+  int steps = 0;
+  while (rwn_history_cursor_step(c, &s, NULL) != -1)
+    steps += 1;
+  ck_assert_int_eq(steps, 6);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 91);
+
+  rwn_history_cursor_reset(c, 0);
+  s.value = 0.0f;
+  ck_assert_int_eq(rwn_history_cursor_run(c, 10, &s, NULL, NULL), 4);
+  ck_assert_float_eq(s.value, 18.0f);
+
+  rwn_history_cursor_destroy(c);
+  rwn_history_destroy(h);
+}
+END_TEST
+
+static bool count_timepoints(RwnTimepoint timepoint,
+                             void* state,
+                             void* user_data) {
+  (void)timepoint;
+  (void)state;
+  *(int*)user_data += 1;
+  return true;
+}
+
+static bool stop_after_last_phase(RwnTimepoint timepoint,
+                                  int phase,
+                                  void* state,
+                                  void* user_data) {
+  (void)timepoint;
+  (void)state;
+  (void)user_data;
+  return phase != INT_MAX;
+}
+
+START_TEST(cursor_steps_over_extreme_phases) {
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {3};
+  struct test_event_mult mult = {2};
+  rwn_history_schedule(h, 0, INT_MIN, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 0, INT_MAX, &mult,
+                       (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  rwn_history_schedule(h, 5, INT_MAX, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  struct test_state s = {0.0f};
+  RwnTimepoint stopped;
+  ck_assert_int_eq(
+      rwn_history_state_delta_until(h, 0, 10, &s, NULL, NULL, &stopped), 3);
+  ck_assert_int_eq(stopped, -1);
+  ck_assert_float_eq(s.value, 9.0f);
+
+  RwnHistoryCursor* c = rwn_history_cursor_create(h, 0);
+  s.value = 0.0f;
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 2);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 1);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 1);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 6);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), -1);
+  ck_assert_float_eq(s.value, 9.0f);
+
+  // stopped by the last phase, the timepoint is done but not reported
+  int timepoints = 0;
+  RwnStepFuncs funcs = {count_timepoints, stop_after_last_phase, &timepoints};
+  rwn_history_cursor_reset(c, 0);
+  s.value = 0.0f;
+  ck_assert_int_eq(rwn_history_cursor_run(c, 10, &s, NULL, &funcs), 2);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 1);
+  ck_assert_int_eq(timepoints, 0);
+  ck_assert_int_eq(rwn_history_cursor_run(c, 10, &s, NULL, &funcs), 1);
+  ck_assert_int_eq(rwn_history_cursor_run(c, 10, &s, NULL, &funcs), 0);
+  ck_assert_int_eq(rwn_history_cursor_timepoint(c), 11);
+  ck_assert_float_eq(s.value, 9.0f);
+  s.value = 0.0f;
+  ck_assert_int_eq(
+      rwn_history_state_delta_until(h, 0, 10, &s, NULL, &funcs, &stopped), 2);
+  ck_assert_int_eq(stopped, 0);
+  ck_assert_int_eq(timepoints, 0);
+
+  rwn_history_cursor_destroy(c);
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(state_delta_dag_same_as_sequential) {
+  RwnHistory* h = rwn_history_create();
+  RwnExecutor* ex = rwn_executor_create(4);
+
+  struct test_event_keyed ev[40];
+  int i;
+  for (i = 0; i < 40; ++i) {
+    ev[i].slot = i % 4;
+    ev[i].timepoint = i / 4;
+    rwn_history_schedule_keyed(h, ev[i].timepoint, 0,
+                               (uint64_t)ev[i].slot + 1, &ev[i],
+                               (RwnEventApplyFunc)test_event_keyed_apply,
+                               NULL);
+  }
+  // sees every slot, so waits for all of the above at timepoints up to 5
+  rwn_history_schedule(h, 5, 1, &ev[0],
+                       (RwnEventApplyFunc)test_event_keyed_sum, NULL);
+
+  struct test_state_keyed expected, actual;
+  memset(&expected, 0, sizeof(expected));
+  memset(&actual, 0, sizeof(actual));
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 9, &expected, NULL), 41);
+  ck_assert_int_eq(rwn_history_state_delta_dag(h, 0, 9, &actual, ex), 41);
+  for (i = 0; i < 4; ++i)
+    ck_assert_int_eq(actual.slots[i], expected.slots[i]);
+  ck_assert_int_eq(actual.total, expected.total);
+
+  rwn_executor_destroy(ex);
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(stats_count_hot_path_calls) {
+  RwnHistory* h = rwn_history_create();
+  struct test_state state;
+  state.value = 1;
+
+  struct test_event_incr e_incr = {1};
+  struct test_event_mult e_mult = {2};
+  rwn_history_schedule(h, 0, 0, &e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 0, 1, &e_mult,
+                       (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  RwnEventHandle* eh = rwn_history_schedule(
+      h, 3, 0, &e_incr, (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 5, 1, &e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_unschedule(h, eh);
+  rwn_history_state_delta(h, 0, 9, &state, 0);
+
+  RwnHistoryStats stats;
+  if (!rwn_history_stats(h, &stats)) {
+    // built without REWIND_STATS: nothing is collected
+    ck_assert_int_eq(stats.events_applied, 0);
+    ck_assert_int_eq(stats.phase_count, 0);
+    rwn_history_destroy(h);
+    return;
+  }
+
+  ck_assert_int_eq(stats.events_scheduled, 4);
+  ck_assert_int_eq(stats.events_unscheduled, 1);
+  ck_assert_int_eq(stats.events_applied, 3);
+  ck_assert_int_eq(stats.timepoints_visited, 2);
+  ck_assert_int_eq(stats.timepoints_empty, 8);
+  ck_assert_int_eq(stats.phases_applied, 3);
+  ck_assert_int_eq(stats.barrier_waits, 0);
+  ck_assert_int_eq(stats.schedule_latency.count, 4);
+  ck_assert_int_eq(stats.state_delta_latency.count, 1);
+
+  // phases 0 and 1, incr and mult
+  ck_assert_int_eq(stats.phase_count, 2);
+  ck_assert_int_eq(stats.phases[0].phase, 0);
+  ck_assert_int_eq(stats.phases[0].events_applied, 1);
+  ck_assert_int_eq(stats.phases[1].events_applied, 2);
+  ck_assert_int_eq(stats.apply_func_count, 2);
+  int i;
+  for (i = 0; i < stats.apply_func_count; ++i) {
+    const RwnApplyFuncStats* fs = &stats.apply_funcs[i];
+    if (fs->func == (RwnEventApplyFunc)test_event_incr_apply)
+      ck_assert_int_eq(fs->events_applied, 2);
+    else
+      ck_assert_int_eq(fs->events_applied, 1);
+    ck_assert_int_eq(fs->apply_latency.count, fs->events_applied);
+  }
+
+  rwn_history_reset_stats(h);
+  rwn_history_stats(h, &stats);
+  ck_assert_int_eq(stats.events_applied, 0);
+  ck_assert_int_eq(stats.phase_count, 0);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+size_t test_event_incr_encode(const struct test_event_incr* e,
+                              void* buf,
+                              size_t buf_size,
+                              void* user_data) {
+  if (buf_size >= sizeof(*e))
+    memcpy(buf, e, sizeof(*e));
+  return sizeof(*e);
+}
+
+void* test_event_incr_decode(const void* payload,
+                             size_t size,
+                             void* user_data) {
+  struct test_event_incr* e = malloc(sizeof(*e));
+  memcpy(e, payload, size);
+  return e;
+}
+
+START_TEST(save_and_load_round_trip) {
+  static const RwnEventApplyFunc apply_funcs[] = {
+      (RwnEventApplyFunc)test_event_incr_apply,
+      (RwnEventApplyFunc)test_event_incr_revert};
+  static const RwnEventDestroyFunc destroy_funcs[] = {free};
+  RwnEventCodec codec;
+  codec.apply_funcs = apply_funcs;
+  codec.apply_func_count = 2;
+  codec.destroy_funcs = destroy_funcs;
+  codec.destroy_func_count = 1;
+  codec.encode = (size_t(*)(const void*, void*, size_t, void*))
+      test_event_incr_encode;
+  codec.decode = test_event_incr_decode;
+  codec.user_data = NULL;
+
+  RwnHistory* h = rwn_history_create();
+  int i;
+  for (i = 0; i < 100; ++i) {
+    struct test_event_incr* e = malloc(sizeof(*e));
+    e->amount = i;
+    rwn_history_schedule_reversible(
+        h, (i * 37) % 23, i % 3, e, (RwnEventApplyFunc)test_event_incr_apply,
+        (RwnEventApplyFunc)test_event_incr_revert, free);
+  }
+
+  char path[] = "/tmp/tst_history_XXXXXX";
+  int fd = mkstemp(path);
+  ck_assert_int_ge(fd, 0);
+  close(fd);
+  ck_assert_int_eq(rwn_history_save(h, path, &codec), 100);
+
+  struct test_state expected;
+  expected.value = 0;
+  rwn_history_state_delta(h, 0, 30, &expected, 0);
+
+  // decoded copies, freed with the restored destroy function
+  RwnHistory* copy = rwn_history_load(path, &codec, NULL);
+  ck_assert_ptr_ne(copy, NULL);
+  struct test_state actual;
+  actual.value = 0;
+  ck_assert_int_eq(rwn_history_state_delta(copy, 0, 30, &actual, 0), 100);
+  ck_assert_int_eq(actual.value, expected.value);
+  ck_assert_int_eq(rwn_history_count_events(copy, 5),
+                   rwn_history_count_events(h, 5));
+  ck_assert_int_eq(rwn_history_state_delta(copy, 30, 0, &actual, 0), 100);
+  ck_assert_int_eq(actual.value, 0);
+
+  // loaded detached, as nothing holds handles to them
+  struct test_visit_log log;
+  log.count = 0;
+  log.limit = 16;
+  ck_assert_int_eq(rwn_history_visit_events(
+                       copy, 0, 30, (RwnEventVisitFunc)test_visit_log_event,
+                       &log),
+                   16);
+  for (i = 0; i < log.count; ++i)
+    ck_assert_ptr_eq(log.handles[i], NULL);
+  rwn_history_destroy(copy);
+
+  // events pointing right into the mapped file
+  codec.decode = NULL;
+  copy = rwn_history_load(path, &codec, NULL);
+  ck_assert_ptr_ne(copy, NULL);
+  actual.value = 0;
+  ck_assert_int_eq(rwn_history_state_delta(copy, 0, 30, &actual, 0), 100);
+  ck_assert_int_eq(actual.value, expected.value);
+  rwn_history_destroy(copy);
+
+  // functions unknown to the codec can not be saved
+  codec.apply_func_count = 1;
+  ck_assert_int_eq(rwn_history_save(h, path, &codec), -1);
+
+  unlink(path);
+  ck_assert_ptr_eq(rwn_history_load(path, &codec, NULL), NULL);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(out_of_order_timepoints_span_many_chunks) {
+  const int NTIMEPOINTS = 5000;
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {1};
+  RwnEventHandle** handles = calloc(NTIMEPOINTS, sizeof(*handles));
+  int i;
+  // every timepoint once, in scattered order; 7919 is prime to 5000
+  for (i = 0; i < NTIMEPOINTS; ++i) {
+    int tp = (int)(((long)i * 7919) % NTIMEPOINTS);
+    handles[tp] = rwn_history_schedule_reversible(
+        h, tp * 3, 0, &incr, (RwnEventApplyFunc)test_event_incr_apply,
+        (RwnEventApplyFunc)test_event_incr_revert, NULL);
+  }
+
+  RwnTimepoint tp = rwn_history_next_timepoint(h, 0);
+  for (i = 0; i < NTIMEPOINTS; ++i) {
+    ck_assert_int_eq(tp, i * 3);
+    tp = rwn_history_next_timepoint(h, tp + 1);
+  }
+  ck_assert_int_eq(tp, -1);
+
+  // every other one of a range, one by one, then a whole range at once
+  for (i = 1000; i < 2000; i += 2)
+    rwn_history_unschedule(h, handles[i]);
+  ck_assert_int_eq(rwn_history_unschedule_all(h, 2000 * 3, 3999 * 3), 2000);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 1999 * 3 + 1), 4000 * 3);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 1000 * 3), 1001 * 3);
+
+  struct test_state s = {0.0f};
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, NTIMEPOINTS * 3, &s, 0),
+                   NTIMEPOINTS - 2500);
+  RwnHistoryVersion* v = rwn_history_version_create(h);
+  ck_assert_int_eq(rwn_history_state_delta(h, NTIMEPOINTS * 3, 1500, &s, 0),
+                   2000);
+  ck_assert_float_eq(s.value, 500.0f);
+
+  // old timepoints go in whole chunks, the version keeps them
+  ck_assert_int_eq(rwn_history_retire(h, 600 * 3), 600);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 0), 600 * 3);
+  ck_assert_int_eq(rwn_history_version_count_events(v, 0), 1);
+  s.value = 0.0f;
+  ck_assert_int_eq(rwn_history_version_state_delta(v, 0, 3000, &s, NULL),
+                   1000);
+  rwn_history_version_release(v);
+
+  // the cursor follows the edits around it
+  RwnHistoryCursor* c = rwn_history_cursor_create(h, 4500 * 3);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 1);
+  for (i = 0; i < 300; ++i)
+    rwn_history_schedule(h, 4500 * 3 + 1 + i * 3, 0, &incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  ck_assert_int_eq(rwn_history_cursor_run(c, NTIMEPOINTS * 3, &s, NULL, NULL),
+                   499 + 300);
+  rwn_history_cursor_destroy(c);
+
+  rwn_history_destroy(h);
+  free(handles);
+}
+END_TEST
+
+#ifndef RWN_TIMEPOINT_32
+START_TEST(timepoints_beyond_32_bits) {
+  // nanosecond ticks: a minute and an hour, and the very last timepoint
+  const RwnTimepoint MINUTE = (RwnTimepoint)60 * 1000000000;
+  const RwnTimepoint HOUR = 60 * MINUTE;
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr incr = {1};
+  struct test_event_mult mult = {10};
+  rwn_history_schedule(h, HOUR, 0, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, MINUTE, 0, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, MINUTE + 1, 0, &mult,
+                       (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  rwn_history_schedule(h, RWN_TIMEPOINT_MAX, 0, &incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  // no two of them collide in the map, nor wrap around in the index
+  ck_assert_int_eq(rwn_history_count_events(h, MINUTE), 1);
+  ck_assert_int_eq(rwn_history_count_events(h, MINUTE % 4294967296), 0);
+  ck_assert(rwn_history_next_timepoint(h, 0) == MINUTE);
+  ck_assert(rwn_history_next_timepoint(h, MINUTE + 2) == HOUR);
+  ck_assert(rwn_history_next_timepoint(h, HOUR + 1) == RWN_TIMEPOINT_MAX);
+
+  struct test_state s = {0.0f};
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, HOUR, &s, 0), 3);
+  ck_assert_float_eq(s.value, 11.0f);
+  ck_assert_int_eq(
+      rwn_history_state_delta(h, HOUR + 1, RWN_TIMEPOINT_MAX, &s, 0), 1);
+  ck_assert_float_eq(s.value, 12.0f);
+
+  // the cursor does not step past the last timepoint
+  RwnHistoryCursor* c = rwn_history_cursor_create(h, HOUR + 1);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), 1);
+  ck_assert(rwn_history_cursor_timepoint(c) == RWN_TIMEPOINT_MAX);
+  ck_assert_int_eq(rwn_history_cursor_step(c, &s, NULL), -1);
+  rwn_history_cursor_destroy(c);
+
+  // a window as wide as the whole range retires nothing
+  rwn_history_set_window(h, RWN_TIMEPOINT_MAX, NULL, NULL);
+  ck_assert_int_eq(rwn_history_count_events(h, MINUTE), 1);
+  rwn_history_set_window(h, HOUR, NULL, NULL);
+  ck_assert_int_eq(rwn_history_count_events(h, MINUTE), 0);
+  ck_assert(rwn_history_watermark(h) > HOUR);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+#endif /* RWN_TIMEPOINT_32 */
+
+struct test_event_counted {
+  int applied;
+  int cost;
+};
+
+void test_event_counted_apply(struct test_event_counted* e, void* s) {
+  // uneven amount of busy work per event
+  volatile int i;
+  for (i = 0; i < e->cost; ++i)
+    ;
+  __atomic_add_fetch(&e->applied, 1, __ATOMIC_RELAXED);
+}
+
+static int test_batch_calls = 0;
+
+void test_event_incr_batch_apply(const struct test_event_incr* e,
+                                 int count,
+                                 struct test_state* s) {
+  int i;
+  for (i = 0; i < count; ++i)
+    s->value += (float)e[i].amount;
+  test_batch_calls += 1;
+}
+
+START_TEST(typed_events_applied_in_batches) {
+  RwnHistory* h = rwn_history_create();
+  RwnEventType type;
+  type.payload_size = sizeof(struct test_event_incr);
+  type.apply_func = (RwnEventApplyFunc)test_event_incr_apply;
+  type.revert_func = NULL;
+  type.batch_apply_func = (RwnEventBatchApplyFunc)test_event_incr_batch_apply;
+  int incr = rwn_history_register_type(h, &type);
+  ck_assert_int_ge(incr, 0);
+
+  // two runs, split by an event of the user's own
+  struct test_event_incr split = {1000};
+  RwnEventHandle* ehs[100];
+  int i;
+  for (i = 0; i < 100; ++i) {
+    struct test_event_incr payload = {i};
+    if (i == 50)
+      rwn_history_schedule(h, 0, 0, &split,
+                           (RwnEventApplyFunc)test_event_incr_apply, NULL);
+    ehs[i] = rwn_history_schedule_typed(h, 0, 0, incr, &payload);
+  }
+
+  struct test_state state = {0};
+  test_batch_calls = 0;
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 0, &state, 0), 101);
+  ck_assert_int_eq(test_batch_calls, 2);
+  ck_assert_float_eq(state.value, 1000 + 99 * 100 / 2);
+
+  // the remaining payloads get repacked as most of them go away
+  for (i = 0; i < 100; ++i)
+    if (i % 10 != 0)
+      rwn_history_unschedule(h, ehs[i]);
+  ck_assert_int_eq(rwn_history_count_events(h, 0), 11);
+
+  state.value = 0;
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 0, &state, 0), 11);
+  ck_assert_float_eq(state.value, 1000 + 450);
+
+  // the same through an executor, one event at a time
+  state.value = 0;
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 0, &state, 1), 11);
+  ck_assert_float_eq(state.value, 1000 + 450);
+
+  // versions take their own copy of the payloads
+  RwnHistoryVersion* v = rwn_history_version_create(h);
+  rwn_history_unschedule_all(h, 0, 0);
+  state.value = 0;
+  test_batch_calls = 0;
+  ck_assert_int_eq(rwn_history_version_state_delta(v, 0, 0, &state, NULL), 11);
+  ck_assert_float_eq(state.value, 1000 + 450);
+  ck_assert_int_gt(test_batch_calls, 0);
+  rwn_history_version_release(v);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+struct test_event_fma {
+  float by;
+  int unused;
+  float add;
+};
+
+void test_event_fma_apply(const struct test_event_fma* e,
+                          struct test_state* s) {
+  s->value = s->value * e->by + e->add;
+}
+
+static int test_columns_misaligned = 0;
+
+void test_event_fma_columns_apply(const void* const* columns,
+                                  int count,
+                                  struct test_state* s) {
+  const float* by = columns[0];
+  const float* add = columns[1];
+  if ((uintptr_t)by % 32 != 0 || (uintptr_t)add % 32 != 0)
+    test_columns_misaligned += 1;
+  int i;
+  for (i = 0; i < count; ++i)
+    s->value = s->value * by[i] + add[i];
+  test_batch_calls += 1;
+}
+
+START_TEST(typed_runs_applied_by_columns) {
+  RwnHistory* h = rwn_history_create();
+  RwnEventType type;
+  type.payload_size = sizeof(struct test_event_fma);
+  type.apply_func = (RwnEventApplyFunc)test_event_fma_apply;
+  type.revert_func = NULL;
+  type.batch_apply_func = NULL;
+  int fma = rwn_history_register_type(h, &type);
+
+  RwnPayloadField fields[2];
+  fields[0].offset = offsetof(struct test_event_fma, by);
+  fields[0].size = sizeof(float);
+  fields[1].offset = sizeof(struct test_event_fma);
+  fields[1].size = sizeof(float);
+  ck_assert_int_eq(rwn_history_set_type_columns(
+                       h, fma, fields, 2,
+                       (RwnEventColumnsApplyFunc)test_event_fma_columns_apply),
+                   -1);
+  fields[1].offset = offsetof(struct test_event_fma, add);
+  ck_assert_int_eq(rwn_history_set_type_columns(
+                       h, fma, fields, 2,
+                       (RwnEventColumnsApplyFunc)test_event_fma_columns_apply),
+                   0);
+
+  // long enough to take several chunks
+  const int NEVENTS = 5000;
+  struct test_state expected = {0};
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    struct test_event_fma payload;
+    payload.by = (i % 2 == 0) ? 0.5f : 1.0f;
+    payload.unused = -1;
+    payload.add = (float)(i % 7);
+    rwn_history_schedule_typed(h, 3, 0, fma, &payload);
+    test_event_fma_apply(&payload, &expected);
+  }
+
+  struct test_state state = {0};
+  test_batch_calls = 0;
+  test_columns_misaligned = 0;
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 3, &state, 0), NEVENTS);
+  ck_assert_int_gt(test_batch_calls, 1);
+  ck_assert_int_eq(test_columns_misaligned, 0);
+  ck_assert_float_eq(state.value, expected.value);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+/*
+ * Async increments which complete when the queue is drained
+ */
+struct test_async_queue {
+  pthread_mutex_t mutex;
+  int count;
+  const struct test_event_incr_mt* evts[256];
+  RwnCompletion* completions[256];
+  struct test_state_mt* state;
+  bool stop;
+};
+
+static struct test_async_queue test_queue;
+
+bool test_event_incr_apply_async(const struct test_event_incr_mt* e,
+                                 struct test_state_mt* s,
+                                 RwnCompletion* completion) {
+  // the odd ones are done right away
+  if (e->amount % 2 != 0) {
+    test_event_incr_apply_mt(e, s);
+    return true;
+  }
+  pthread_mutex_lock(&test_queue.mutex);
+  test_queue.evts[test_queue.count] = e;
+  test_queue.completions[test_queue.count] = completion;
+  test_queue.count += 1;
+  test_queue.state = s;
+  pthread_mutex_unlock(&test_queue.mutex);
+  return false;
+}
+
+static void test_queue_drain(void* user_data) {
+  (void)user_data;
+  pthread_mutex_lock(&test_queue.mutex);
+  int i;
+  for (i = 0; i < test_queue.count; ++i) {
+    test_event_incr_apply_mt(test_queue.evts[i], test_queue.state);
+    rwn_completion_done(test_queue.completions[i]);
+  }
+  test_queue.count = 0;
+  pthread_mutex_unlock(&test_queue.mutex);
+}
+
+static void* test_queue_thread(void* arg) {
+  (void)arg;
+  while (!__atomic_load_n(&test_queue.stop, __ATOMIC_ACQUIRE)) {
+    test_queue_drain(NULL);
+    usleep(100);
+  }
+  return NULL;
+}
+
+void test_event_mult_apply_mt(const struct test_event_mult* e,
+                              struct test_state_mt* s) {
+  s->value *= (float)e->by;
+}
+
+static RwnHistory* test_async_history(struct test_event_incr_mt* evts,
+                                      struct test_event_mult* twice) {
+  RwnHistory* h = rwn_history_create();
+  int i;
+  for (i = 0; i < 200; ++i) {
+    evts[i].amount = i;
+    rwn_history_schedule_async(
+        h, 1, 0, &evts[i], (RwnEventAsyncApplyFunc)test_event_incr_apply_async,
+        NULL);
+  }
+  // only once all of the increments are in
+  twice->by = 2;
+  rwn_history_schedule(h, 1, 1, twice,
+                       (RwnEventApplyFunc)test_event_mult_apply_mt, NULL);
+  return h;
+}
+
+START_TEST(async_events_complete_before_phase_barrier) {
+  struct test_event_incr_mt evts[200];
+  struct test_event_mult twice;
+  RwnHistory* h = test_async_history(evts, &twice);
+  pthread_mutex_init(&test_queue.mutex, NULL);
+  test_queue.count = 0;
+
+  // completions polled by the applying thread
+  RwnCompletionSource source;
+  source.wait = test_queue_drain;
+  source.user_data = NULL;
+  rwn_history_set_completion_source(h, &source);
+
+  struct test_state_mt state;
+  state.value = 0;
+  pthread_mutex_init(&state.mutex, NULL);
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 1, &state, 0), 201);
+  ck_assert_float_eq(state.value, 2 * (199 * 200 / 2));
+
+  // async events go phase by phase and are not reversible
+  RwnExecutor* ex = rwn_executor_create(2);
+  state.value = 0;
+  ck_assert_int_eq(rwn_history_state_delta_dag(h, 0, 1, &state, ex), 201);
+  ck_assert_float_eq(state.value, 2 * (199 * 200 / 2));
+  ck_assert_int_eq(rwn_history_state_delta(h, 1, 0, &state, 0), -1);
+  rwn_executor_destroy(ex);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(async_events_completed_by_other_thread) {
+  struct test_event_incr_mt evts[200];
+  struct test_event_mult twice;
+  RwnHistory* h = test_async_history(evts, &twice);
+  pthread_mutex_init(&test_queue.mutex, NULL);
+  test_queue.count = 0;
+  test_queue.stop = false;
+  pthread_t completer;
+  pthread_create(&completer, NULL, test_queue_thread, NULL);
+
+  struct test_state_mt state;
+  state.value = 0;
+  pthread_mutex_init(&state.mutex, NULL);
+  RwnExecutor* ex = rwn_executor_create(4);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 1, &state, ex), 201);
+  ck_assert_float_eq(state.value, 2 * (199 * 200 / 2));
+  rwn_executor_destroy(ex);
+
+  __atomic_store_n(&test_queue.stop, true, __ATOMIC_RELEASE);
+  pthread_join(completer, NULL);
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(executor_applies_every_event_of_uneven_phase_once) {
+  const int NEVENTS = 10000;
+  struct test_event_counted* ev = calloc(NEVENTS, sizeof(*ev));
+
+  RwnHistory* h = rwn_history_create();
+  RwnExecutor* ex = rwn_executor_create(8);
+
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    ev[i].cost = (i % 100 == 0) ? 100000 : 10;
+    rwn_history_schedule(h, 0, i % 2, &ev[i],
+                         (RwnEventApplyFunc)test_event_counted_apply, NULL);
+  }
+
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 0, NULL, ex), NEVENTS);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 0, NULL, ex), NEVENTS);
+  for (i = 0; i < NEVENTS; ++i)
+    ck_assert_int_eq(ev[i].applied, 2);
+
+  rwn_executor_destroy(ex);
+  rwn_history_destroy(h);
+  free(ev);
+}
+END_TEST
+
+START_TEST(pinned_executor_applies_every_event_once) {
+  const int NEVENTS = 1000;
+  struct test_event_counted* ev = calloc(NEVENTS, sizeof(*ev));
+
+  RwnHistory* h = rwn_history_create();
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    ev[i].cost = 10;
+    rwn_history_schedule(h, 0, 0, &ev[i],
+                         (RwnEventApplyFunc)test_event_counted_apply, NULL);
+  }
+
+  int cpus[1] = {0};
+  ck_assert_ptr_eq(rwn_executor_create_pinned(4, cpus, 0), NULL);
+  cpus[0] = -1;
+  ck_assert_ptr_eq(rwn_executor_create_pinned(4, cpus, 1), NULL);
+  ck_assert_ptr_eq(rwn_executor_create_on_node(4, -1), NULL);
+
+  // more workers than CPUs
+  cpus[0] = 0;
+  RwnExecutor* ex = rwn_executor_create_pinned(4, cpus, 1);
+  ck_assert_ptr_ne(ex, NULL);
+  ck_assert_int_eq(rwn_executor_worker_cpu(ex, 0), -1);
+  ck_assert_int_eq(rwn_executor_worker_cpu(ex, 3), 0);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 0, NULL, ex), NEVENTS);
+  rwn_executor_destroy(ex);
+
+  // the node may not exist if the system has no NUMA support
+  ex = rwn_executor_create_on_node(4, 0);
+  if (ex != NULL) {
+    ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 0, NULL, ex), NEVENTS);
+    rwn_executor_destroy(ex);
+    for (i = 0; i < NEVENTS; ++i)
+      ck_assert_int_eq(ev[i].applied, 2);
+  }
+
+  rwn_history_destroy(h);
+  free(ev);
+}
+END_TEST
+
+START_TEST(deterministic_replay_is_traced_per_worker) {
+  const int NEVENTS = 100;
+  struct test_event_counted* ev = calloc(NEVENTS, sizeof(*ev));
+
+  RwnHistory* h = rwn_history_create();
+  int i;
+  for (i = 0; i < NEVENTS; ++i) {
+    ev[i].cost = i % 7 == 0 ? 1000 : 10;
+    rwn_history_schedule(h, i % 2, 0, &ev[i],
+                         (RwnEventApplyFunc)test_event_counted_apply, NULL);
+  }
+
+  ck_assert_ptr_eq(rwn_trace_create(0, 10), NULL);
+  ck_assert_ptr_eq(rwn_trace_create(4, 0), NULL);
+  RwnTrace* trace = rwn_trace_create(4, 1000);
+  if (!rwn_history_set_trace(h, trace)) {
+    // built without REWIND_TRACE: nothing is recorded
+    ck_assert_int_eq(rwn_history_state_delta(h, 0, 1, NULL, 0), NEVENTS);
+    ck_assert_int_eq(rwn_trace_count(trace), 0);
+    rwn_trace_destroy(trace);
+    rwn_history_destroy(h);
+    free(ev);
+    return;
+  }
+
+  RwnExecutor* ex = rwn_executor_create(4);
+  rwn_executor_set_deterministic(ex, true);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 1, NULL, ex), NEVENTS);
+
+  // every phase of 50 events is dealt to the workers in chunks of 12 or 13
+  ck_assert_int_eq(rwn_trace_count(trace), NEVENTS);
+  ck_assert_int_eq(rwn_trace_dropped(trace), 0);
+  RwnTraceRecord* records = calloc(NEVENTS, sizeof(*records));
+  ck_assert_int_eq(rwn_trace_records(trace, records), NEVENTS);
+  for (i = 0; i < NEVENTS; ++i) {
+    ck_assert_int_eq(records[i].phase, 0);
+    ck_assert_int_eq(records[i].event_count, 1);
+    ck_assert_int_eq(records[i].worker, (records[i].event * 4 + 3) / 50);
+    ck_assert(records[i].end_ns >= records[i].start_ns);
+    if (i > 0)
+      ck_assert(records[i].start_ns >= records[i - 1].start_ns);
+  }
+
+  char path[] = "/tmp/tst_history_XXXXXX";
+  int fd = mkstemp(path);
+  ck_assert_int_ge(fd, 0);
+  close(fd);
+  ck_assert(rwn_trace_save_chrome(trace, path));
+  FILE* f = fopen(path, "r");
+  char head[19] = {0};
+  ck_assert_int_eq(fread(head, 1, sizeof(head) - 1, f), sizeof(head) - 1);
+  fclose(f);
+  unlink(path);
+  ck_assert_str_eq(head, "{\"displayTimeUnit\"");
+
+  // the sequential replay is recorded as worker zero, the oldest overwritten
+  rwn_trace_destroy(trace);
+  trace = rwn_trace_create(1, 10);
+  rwn_history_set_trace(h, trace);
+  ck_assert_int_eq(rwn_history_state_delta(h, 0, 1, NULL, 0), NEVENTS);
+  ck_assert_int_eq(rwn_trace_count(trace), 10);
+  ck_assert_int_eq(rwn_trace_dropped(trace), NEVENTS - 10);
+  ck_assert_int_eq(rwn_trace_records(trace, records), 10);
+  for (i = 0; i < 10; ++i) {
+    ck_assert_int_eq(records[i].timepoint, 1);
+    ck_assert_int_eq(records[i].event, 40 + i);
+    ck_assert_int_eq(records[i].worker, 0);
+  }
+
+  // nothing is recorded once the trace is off
+  rwn_trace_clear(trace);
+  rwn_history_set_trace(h, NULL);
+  ck_assert_int_eq(rwn_history_state_delta_ex(h, 0, 1, NULL, ex), NEVENTS);
+  ck_assert_int_eq(rwn_trace_count(trace), 0);
+  for (i = 0; i < NEVENTS; ++i)
+    ck_assert_int_eq(ev[i].applied, 3);
+
+  rwn_executor_destroy(ex);
+  rwn_trace_destroy(trace);
+  rwn_history_destroy(h);
+  free(records);
+  free(ev);
+}
+END_TEST
+
+struct test_snapshot_stats {
+  int saved;
+  int discarded;
+};
+
+void* test_state_save(const struct test_state* s,
+                      struct test_snapshot_stats* stats) {
+  struct test_state* snapshot = malloc(sizeof(*snapshot));
+  *snapshot = *s;
+  stats->saved += 1;
+  return snapshot;
+}
+
+void test_state_restore(struct test_state* s,
+                        const struct test_state* snapshot,
+                        struct test_snapshot_stats* stats) {
+  (void)stats;
+  *s = *snapshot;
+}
+
+void test_state_discard(struct test_state* snapshot,
+                        struct test_snapshot_stats* stats) {
+  stats->discarded += 1;
+  free(snapshot);
+}
+
+static RwnCheckpointFuncs test_checkpoint_funcs(
+    struct test_snapshot_stats* stats) {
+  RwnCheckpointFuncs funcs;
+  funcs.save = (void* (*)(const void*, void*))test_state_save;
+  funcs.restore = (void (*)(void*, const void*, void*))test_state_restore;
+  funcs.discard = (void (*)(void*, void*))test_state_discard;
+  funcs.user_data = stats;
+  return funcs;
+}
+
+START_TEST(seek_replays_from_nearest_checkpoint) {
+  struct test_snapshot_stats stats = {0, 0};
+  RwnCheckpointFuncs funcs = test_checkpoint_funcs(&stats);
+  struct test_state initial = {0};
+  struct test_state state = {-1000};
+
+  RwnHistory* h = rwn_history_create();
+  ck_assert_int_eq(rwn_history_seek(h, 0, &state), -1);
+
+  struct test_event_incr e_incr = {1};
+  int i;
+  for (i = 0; i < 100; ++i)
+    rwn_history_schedule(h, i, 0, &e_incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  rwn_history_enable_checkpoints(h, &funcs, 10, &initial);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 1);
+
+  ck_assert_int_eq(rwn_history_seek(h, 99, &state), 100);
+  ck_assert_int_eq(state.value, 100);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 11);
+
+  // back and forth, replaying only from the checkpoint before
+  ck_assert_int_eq(rwn_history_seek(h, 55, &state), 6);
+  ck_assert_int_eq(state.value, 56);
+  ck_assert_int_eq(rwn_history_seek(h, 9, &state), 0);
+  ck_assert_int_eq(state.value, 10);
+  ck_assert_int_eq(rwn_history_seek(h, 3, &state), 4);
+  ck_assert_int_eq(state.value, 4);
+
+  // the past changed: checkpoints after it are dropped
+  struct test_event_mult e_mult = {2};
+  rwn_history_schedule(h, 30, 1, &e_mult,
+                       (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 4);
+  ck_assert_int_eq(rwn_history_seek(h, 99, &state), 71);
+  ck_assert_int_eq(state.value, 31 * 2 + 69);
+
+  rwn_history_destroy(h);
+  ck_assert_int_eq(stats.saved, stats.discarded);
+}
+END_TEST
+
+START_TEST(reevaluate_replays_only_after_edit) {
+  struct test_snapshot_stats stats = {0, 0};
+  RwnCheckpointFuncs funcs = test_checkpoint_funcs(&stats);
+  struct test_state initial = {0};
+  struct test_state state;
+
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr e_incr = {1};
+  int i;
+  for (i = 0; i < 100; ++i)
+    rwn_history_schedule(h, i, 0, &e_incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_enable_checkpoints(h, &funcs, 10, &initial);
+
+  // continues from the state at hand
+  ck_assert_int_eq(rwn_history_seek(h, 49, &state), 50);
+  ck_assert_int_eq(rwn_history_reevaluate(h, 99, &state), 50);
+  ck_assert_int_eq(state.value, 100);
+  ck_assert_int_eq(rwn_history_reevaluate(h, 99, &state), 0);
+  ck_assert_int_eq(rwn_history_dirty_timepoint(h), -1);
+
+  // edit near the end: only the last block is replayed
+  struct test_event_mult e_mult = {2};
+  RwnEventHandle* eh = rwn_history_schedule(
+      h, 95, 1, &e_mult, (RwnEventApplyFunc)test_event_mult_apply, NULL);
+  ck_assert_int_eq(rwn_history_dirty_timepoint(h), 95);
+  ck_assert_int_eq(rwn_history_reevaluate(h, 99, &state), 11);
+  ck_assert_int_eq(state.value, 96 * 2 + 4);
+  ck_assert_int_eq(rwn_history_dirty_timepoint(h), -1);
+
+  // edit after the state at hand does not throw it away
+  ck_assert_int_eq(rwn_history_reevaluate(h, 80, &state), 1);
+  rwn_history_unschedule(h, eh);
+  ck_assert_int_eq(rwn_history_reevaluate(h, 85, &state), 5);
+  ck_assert_int_eq(state.value, 86);
+
+  // but a valid checkpoint closer to the target wins
+  ck_assert_int_eq(rwn_history_reevaluate(h, 99, &state), 10);
+  ck_assert_int_eq(state.value, 100);
+
+  rwn_history_destroy(h);
+  ck_assert_int_eq(stats.saved, stats.discarded);
+}
+END_TEST
+
+struct test_retire_log {
+  int calls;
+  RwnTimepoint first;
+  RwnTimepoint last;
+};
+
+void test_retire(const RwnHistory* h,
+                 RwnTimepoint first_timepoint,
+                 RwnTimepoint last_timepoint,
+                 struct test_retire_log* log) {
+  log->calls += 1;
+  log->first = first_timepoint;
+  log->last = last_timepoint;
+}
+
+START_TEST(window_retires_old_timepoints) {
+  RwnHistory* h = rwn_history_create();
+  struct test_retire_log log = {0, -1, -1};
+  rwn_history_set_window(h, 10, (RwnRetireFunc)test_retire, &log);
+
+  struct test_event_alive ev[100];
+  int i;
+  for (i = 0; i < 100; ++i) {
+    ev[i].alive = true;
+    rwn_history_schedule(h, i, 0, &ev[i], NULL,
+                         (RwnEventDestroyFunc)test_event_alive_destroy);
+  }
+
+  // retired a window at a time, once the history spanned two windows
+  // (at timepoints 20, 31, ..., 97, keeping the last 10 each time)
+  ck_assert_int_eq(log.calls, 8);
+  ck_assert_int_eq(log.first, 77);
+  ck_assert_int_eq(log.last, 87);
+  ck_assert_int_eq(rwn_history_watermark(h), 88);
+  ck_assert_int_eq(ev[87].alive, false);
+  ck_assert_int_eq(ev[88].alive, true);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 0), 88);
+
+  // the retired past is gone for good
+  ck_assert_ptr_eq(rwn_history_schedule(h, 50, 0, &ev[0], NULL, NULL), NULL);
+
+  ck_assert_int_eq(rwn_history_retire(h, 95), 7);
+  ck_assert_int_eq(ev[94].alive, false);
+  ck_assert_int_eq(rwn_history_count_events(h, 95), 1);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(window_refuses_timepoints_it_retires) {
+  RwnHistory* h = rwn_history_create();
+  rwn_history_set_window(h, 10, NULL, NULL);
+
+  RwnEventHandle* eh100 = rwn_history_schedule(h, 100, 0, NULL, NULL, NULL);
+  RwnEventHandle* eh150 = rwn_history_schedule(h, 150, 0, NULL, NULL, NULL);
+  RwnEventHandle* eh165 = rwn_history_schedule(h, 165, 0, NULL, NULL, NULL);
+  ck_assert_int_eq(rwn_history_watermark(h), 141);
+  rwn_history_unschedule(h, eh150);
+
+  // not retired yet, but scheduling there slides the window past it
+  ck_assert_ptr_eq(rwn_history_schedule(h, 142, 0, NULL, NULL, NULL), NULL);
+  ck_assert_int_eq(rwn_history_watermark(h), 156);
+  ck_assert_int_eq(rwn_history_count_events(h, 142), 0);
+
+  RwnEventSpec specs[2] = {{0}};
+  specs[0].timepoint = 190;
+  specs[1].timepoint = 170;
+  RwnEventHandle* handles[2];
+  ck_assert_int_eq(rwn_history_schedule_many(h, specs, 2, handles), 1);
+  ck_assert_ptr_ne(handles[0], NULL);
+  ck_assert_ptr_eq(handles[1], NULL);
+  ck_assert_int_eq(rwn_history_count_events(h, 170), 0);
+  ck_assert_int_eq(rwn_history_next_timepoint(h, 0), 190);
+
+  // the new events reuse the freed slots, but never the old handles
+  RwnEventHandle* eh = rwn_history_schedule(h, 195, 0, NULL, NULL, NULL);
+  ck_assert_ptr_ne(eh, NULL);
+  ck_assert_ptr_ne(eh, eh100);
+  ck_assert_ptr_ne(eh, eh150);
+  ck_assert_ptr_ne(eh, eh165);
+  ck_assert_ptr_ne(handles[0], eh100);
+  ck_assert_ptr_ne(handles[0], eh150);
+  ck_assert_ptr_ne(handles[0], eh165);
+
+  // and the stale handles leave them be
+  rwn_history_unschedule(h, eh100);
+  rwn_history_unschedule(h, eh150);
+  rwn_history_unschedule(h, eh165);
+  ck_assert_int_eq(rwn_history_count_events(h, 190), 1);
+  ck_assert_int_eq(rwn_history_count_events(h, 195), 1);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
+START_TEST(retire_keeps_checkpoints_usable) {
+  struct test_snapshot_stats stats = {0, 0};
+  RwnCheckpointFuncs funcs = test_checkpoint_funcs(&stats);
+  struct test_state initial = {0};
+  struct test_state state = {0};
+
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr e_incr = {1};
+  int i;
+  for (i = 0; i < 100; ++i)
+    rwn_history_schedule(h, i, 0, &e_incr,
+                         (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_enable_checkpoints(h, &funcs, 10, &initial);
+
+  // nothing has seen the events yet, so nothing can go
+  ck_assert_int_eq(rwn_history_retire(h, 50), 0);
+  ck_assert_int_eq(rwn_history_watermark(h), 0);
+
+  // stops right after the checkpoint at 19
+  ck_assert_int_eq(rwn_history_seek(h, 25, &state), 26);
+  ck_assert_int_eq(rwn_history_retire(h, 50), 20);
+  ck_assert_int_eq(rwn_history_watermark(h), 20);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 1);
+
+  ck_assert_int_eq(rwn_history_seek(h, 5, &state), -1);
+  ck_assert_int_eq(rwn_history_seek(h, 99, &state), 80);
+  ck_assert_int_eq(state.value, 100);
+
+  rwn_history_destroy(h);
+  ck_assert_int_eq(stats.saved, stats.discarded);
+}
+END_TEST
+
+START_TEST(seek_over_sparse_history_skips_empty_blocks) {
+  struct test_snapshot_stats stats = {0, 0};
+  RwnCheckpointFuncs funcs = test_checkpoint_funcs(&stats);
+  struct test_state initial = {1};
+  struct test_state state;
+
+  RwnHistory* h = rwn_history_create();
+  struct test_event_incr e_incr = {1};
+  rwn_history_schedule(h, 0, 0, &e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+  rwn_history_schedule(h, 2000000000, 0, &e_incr,
+                       (RwnEventApplyFunc)test_event_incr_apply, NULL);
+
+  rwn_history_enable_checkpoints(h, &funcs, 1, &initial);
+  ck_assert_int_eq(rwn_history_seek(h, 2147483647, &state), 2);
+  ck_assert_int_eq(state.value, 3);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 3);
+
+  ck_assert_int_eq(rwn_history_seek(h, 1999999999, &state), 0);
+  ck_assert_int_eq(state.value, 2);
+
+  rwn_history_disable_checkpoints(h);
+  ck_assert_int_eq(rwn_history_count_checkpoints(h), 0);
+  ck_assert_int_eq(stats.saved, stats.discarded);
+
+  rwn_history_destroy(h);
+}
+END_TEST
+
 /*
  * TEST DRIVER CODE
  */
@@ -373,6 +2301,7 @@ Suite* make_suite(void) {
 
   tc_core = tcase_create("Initialization");
   tcase_add_test(tc_core, create_allocates_memory);
+  tcase_add_test(tc_core, create_ex_takes_memory_from_allocator);
   tcase_add_test_raise_signal(tc_core, destroy_deallocates_memory, 11);
   tcase_add_test(tc_core, destroy_destroys_events_with_callback);
   suite_add_tcase(s, tc_core);
@@ -380,12 +2309,51 @@ Suite* make_suite(void) {
   tc_core = tcase_create("Scheduling");
   tcase_add_test(tc_core, no_state_delta_after_no_events);
   tcase_add_test(tc_core, events_added_and_removed_from_scheduler);
+  tcase_add_test(tc_core, unschedule_keeps_other_handles_valid);
   tcase_add_test(tc_core, unschedule_destroys_events_with_callback);
   tcase_add_test(tc_core, state_delta_after_events);
+  tcase_add_test(tc_core, state_delta_visits_sparse_timepoints_in_order);
   tcase_add_test(tc_core, scheduled_event_count_and_ptrs_returned);
+  tcase_add_test(tc_core, visit_events_in_timepoint_and_phase_order);
+  tcase_add_test(tc_core, detached_events_take_no_handles);
   tcase_add_test(tc_core, unschedule_all_destroys_events);
+  tcase_add_test(tc_core, events_grouped_by_phase_in_scheduling_order);
+  tcase_add_test(tc_core, unschedule_all_truncates_future_keeping_past);
+  tcase_add_test(tc_core, schedule_many_same_as_one_by_one);
+  tcase_add_test(tc_core, posted_events_scheduled_on_flush);
+  tcase_add_test(tc_core, version_replays_while_history_is_edited);
   tcase_add_test(tc_core, scheduled_events_applied_by_phases);
   tcase_add_test(tc_core, state_delta_after_events_with_multithreaded_phases);
+  tcase_add_test(tc_core, state_delta_ex_reuses_executor_across_calls);
+  tcase_add_test(tc_core, state_delta_backwards_reverts_events);
+  tcase_add_test(tc_core, state_delta_sharded_merges_shards_at_phase_end);
+  tcase_add_test(tc_core, state_delta_dag_same_as_sequential);
+  tcase_add_test(tc_core, state_delta_multi_same_as_one_by_one);
+  tcase_add_test(tc_core, state_delta_until_stops_where_condition_holds);
+  tcase_add_test(tc_core, cursor_steps_and_resumes_after_edits);
+  tcase_add_test(tc_core, cursor_steps_over_extreme_phases);
+  tcase_add_test(tc_core, stats_count_hot_path_calls);
+  tcase_add_test(tc_core, save_and_load_round_trip);
+  tcase_add_test(tc_core, out_of_order_timepoints_span_many_chunks);
+#ifndef RWN_TIMEPOINT_32
+  tcase_add_test(tc_core, timepoints_beyond_32_bits);
+#endif
+  tcase_add_test(tc_core, executor_applies_every_event_of_uneven_phase_once);
+  tcase_add_test(tc_core, pinned_executor_applies_every_event_once);
+  tcase_add_test(tc_core, deterministic_replay_is_traced_per_worker);
+  tcase_add_test(tc_core, typed_events_applied_in_batches);
+  tcase_add_test(tc_core, typed_runs_applied_by_columns);
+  tcase_add_test(tc_core, async_events_complete_before_phase_barrier);
+  tcase_add_test(tc_core, async_events_completed_by_other_thread);
+  suite_add_tcase(s, tc_core);
+
+  tc_core = tcase_create("Checkpoints");
+  tcase_add_test(tc_core, seek_replays_from_nearest_checkpoint);
+  tcase_add_test(tc_core, reevaluate_replays_only_after_edit);
+  tcase_add_test(tc_core, seek_over_sparse_history_skips_empty_blocks);
+  tcase_add_test(tc_core, window_retires_old_timepoints);
+  tcase_add_test(tc_core, window_refuses_timepoints_it_retires);
+  tcase_add_test(tc_core, retire_keeps_checkpoints_usable);
   suite_add_tcase(s, tc_core);
 
   return s;